@@ -0,0 +1,77 @@
+/* bitset.h
+ *
+ * Fixed-size bitsets over compact label ids, stored as arrays of
+ * machine words.
+ */
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <limits.h>
+#include <stddef.h>
+
+typedef unsigned long	bitword;
+
+#define BITWORD_BITS		(CHAR_BIT*sizeof(bitword))
+#define BITSET_WORDS(n)		(((n)+BITWORD_BITS-1)/BITWORD_BITS)
+#define BITSET_BYTES(n)		(BITSET_WORDS(n)*sizeof(bitword))
+
+#define BITSET_TEST(bs, i)	(((bs)[(i)/BITWORD_BITS] >> ((i)%BITWORD_BITS)) & 1UL)
+#define BITSET_SET(bs, i)	((bs)[(i)/BITWORD_BITS] |= 1UL << ((i)%BITWORD_BITS))
+#define BITSET_CLEAR(bs, i)	((bs)[(i)/BITWORD_BITS] &= ~(1UL << ((i)%BITWORD_BITS)))
+
+/* bitset_next() returns the first set bit of bs at or after i, or n if
+ * there is none before n.
+ */
+static inline size_t
+bitset_next(const bitword *bs, size_t i, size_t n)
+{
+  size_t  w = i/BITWORD_BITS;
+  bitword b;
+
+  if (i >= n)
+    return n;
+  b = bs[w] & (~0UL << (i%BITWORD_BITS));
+  while (!b) {
+    if (++w*BITWORD_BITS >= n)
+      return n;
+    b = bs[w];
+  }
+  i = w*BITWORD_BITS + __builtin_ctzl(b);
+  return i < n ? i : n;
+}
+
+/* bitset_next_and() is like bitset_next(), but for the intersection of
+ * bs1 and bs2.
+ */
+static inline size_t
+bitset_next_and(const bitword *bs1, const bitword *bs2, size_t i, size_t n)
+{
+  size_t  w = i/BITWORD_BITS;
+  bitword b;
+
+  if (i >= n)
+    return n;
+  b = bs1[w] & bs2[w] & (~0UL << (i%BITWORD_BITS));
+  while (!b) {
+    if (++w*BITWORD_BITS >= n)
+      return n;
+    b = bs1[w] & bs2[w];
+  }
+  i = w*BITWORD_BITS + __builtin_ctzl(b);
+  return i < n ? i : n;
+}
+
+/* bitset_intersects() is non-zero iff bs1 and bs2 share a bit below n */
+static inline int
+bitset_intersects(const bitword *bs1, const bitword *bs2, size_t n)
+{
+  size_t w;
+
+  for (w = 0; w < BITSET_WORDS(n); w++)
+    if (bs1[w] & bs2[w])
+      return 1;
+  return 0;
+}
+
+#endif
@@ -14,4 +14,12 @@
 void blockalloc_free_all(void);
 void * blockalloc_malloc(size_t n_char);
 
+/* blockalloc_take() returns this thread's blocks and leaves it with
+ * none, and blockalloc_give() adds blocks taken by some thread to this
+ * thread's, so they are freed with them.
+ */
+struct blockalloc;
+struct blockalloc * blockalloc_take(void);
+void blockalloc_give(struct blockalloc *blocks);
+
 #endif
@@ -0,0 +1,192 @@
+/* cky-templates.h
+ *
+ * CKY code templates.
+ *
+ * This file defines two macros, which in turn define CKY parsers that
+ * compute the value of the root category over a semiring.
+ *
+ * CKY_CODE(CKY, VALUE, ZERO, ONE, PLUS, TIMES, WEIGHT, UNARY, UWEIGHT)
+ *   defines a parser whose function names have the prefix CKY, and
+ *   where
+ *       VALUE is the type of semiring values
+ *       ZERO and ONE are the identities of PLUS and TIMES
+ *       PLUS(x, y) and TIMES(x, y) are the semiring operations
+ *       WEIGHT(lprob) is the value of a rule with log prob lprob
+ *       UNARY(g) returns the closure of g's unary rules in the
+ *         semiring, as a sum_closure (see closure.h)
+ *       UWEIGHT(x) is the value of an entry x of that closure
+ *
+ * CKY_HEADER(CKY, VALUE) declares the functions CKY_CODE defines:
+ *
+ *   CKY_grammar make_CKY_grammar(const grammar *g) returns g with its
+ *     rules weighted for the semiring
+ *   free_CKY_grammar(CKY_grammar sg) frees it
+ *   VALUE CKY(CKY_grammar sg, const struct vindex *terms) returns the
+ *     value of the root over terms, or ZERO if there is none
+ *
+ * The parser is CKY over dense arrays of values indexed by compact
+ * nonterminal id, with a pre and a post unary layer in each span as in
+ * inout.c; the post layer is the pre layer times the unary closure.
+ * Since the operations are macros, each parser's inner loop is
+ * specialized to its semiring.
+ */
+
+#include <assert.h>
+#include "mmm.h"
+#include "lgrammar.h"
+#include "vindex.h"
+#include "bitset.h"
+#include "closure.h"
+
+#define CKY_SPAN(i, j)	((j)*((j)-1)/2+(i))
+
+#define CKY_HEADER(CKY, VALUE)						\
+									\
+typedef struct CKY ## _grammar {					\
+  const grammar	*g;							\
+  unsigned	*bparent;	/* id of each of g->bparents */		\
+  VALUE		*bweight;	/* weight of each of g->bparents */	\
+  sum_closure	unary;		/* the unary closure ... */		\
+  VALUE		*uweight;	/* ... and the value of each entry */	\
+} *CKY ## _grammar;							\
+									\
+CKY ## _grammar make_ ## CKY ## _grammar(const grammar *g);		\
+void free_ ## CKY ## _grammar(CKY ## _grammar sg);			\
+VALUE CKY(CKY ## _grammar sg, const struct vindex *terms);
+
+
+#define CKY_CODE(CKY, VALUE, ZERO, ONE, PLUS, TIMES, WEIGHT, UNARY, UWEIGHT) \
+									\
+/* CKY_HEADER(CKY, VALUE) */						\
+									\
+CKY ## _grammar make_ ## CKY ## _grammar(const grammar *g)		\
+{									\
+  CKY ## _grammar sg = MALLOC(sizeof(struct CKY ## _grammar));		\
+  size_t nb = g->bpairs[g->nbpairs].start, i;				\
+									\
+  sg->g = g;								\
+  sg->bparent = MALLOC((nb + 1) * sizeof(unsigned));			\
+  sg->bweight = MALLOC((nb + 1) * sizeof(VALUE));			\
+  for (i = 0; i < nb; i++) {						\
+    sg->bparent[i] = g->label_id[g->bparents[i].parent];		\
+    sg->bweight[i] = WEIGHT(g->bparents[i].prob);			\
+  }									\
+  sg->unary = UNARY(g);							\
+  sg->uweight = MALLOC((sg->unary->start[g->nnts] + 1) * sizeof(VALUE)); \
+  for (i = 0; i < sg->unary->start[g->nnts]; i++)			\
+    sg->uweight[i] = UWEIGHT(sg->unary->sums[i].sum);			\
+  return sg;								\
+}									\
+									\
+void free_ ## CKY ## _grammar(CKY ## _grammar sg)			\
+{									\
+  FREE(sg->bparent);							\
+  FREE(sg->bweight);							\
+  free_sum_closure(sg->unary);						\
+  FREE(sg->uweight);							\
+  FREE(sg);								\
+}									\
+									\
+/* CKY ## _binary() adds the parents of left child b (with value lv)	\
+ * and every right child over j..k to the pre layer pre, bpre.		\
+ */									\
+static inline void CKY ## _binary(CKY ## _grammar sg, unsigned b, VALUE lv, \
+				  const VALUE *rpost, const bitword *rin, \
+				  unsigned rterm, VALUE *pre, bitword *bpre) \
+{									\
+  const grammar	*g = sg->g;						\
+  const bpair	*bp, *end = g->bpairs + g->bleft_start[b+1];		\
+  size_t	x;							\
+									\
+  for (bp = g->bpairs + g->bleft_start[b]; bp < end; bp++) {		\
+    VALUE lr;								\
+									\
+    if (bp->right < g->nnts) {						\
+      if (!BITSET_TEST(rin, bp->right))					\
+	continue;							\
+      lr = TIMES(lv, rpost[bp->right]);					\
+    }									\
+    else if (bp->right == rterm)					\
+      lr = lv;								\
+    else								\
+      continue;								\
+    for (x = bp->start; x < bp[1].start; x++) {				\
+      unsigned a = sg->bparent[x];					\
+      pre[a] = PLUS(pre[a], TIMES(lr, sg->bweight[x]));			\
+      BITSET_SET(bpre, a);						\
+    }}}									\
+									\
+VALUE CKY(CKY ## _grammar sg, const struct vindex *terms)		\
+{									\
+  const grammar	*g = sg->g;						\
+  size_t	n = terms->n, nnts = g->nnts, words = BITSET_WORDS(nnts); \
+  size_t	nspans = n*(n+1)/2, i, j, k, len, b, x;			\
+  unsigned	*term;							\
+  VALUE		*pre, *post, result = ZERO;				\
+  bitword	*inpre, *inpost;					\
+									\
+  if (n == 0)								\
+    return ZERO;							\
+  term = MALLOC(n * sizeof(unsigned));					\
+  for (i = 0; i < n; i++)						\
+    if ((term[i] = grammar_label_id(g, terms->e[i])) == NO_ID) {	\
+      FREE(term);		/* unknown word, so no parse */		\
+      return ZERO;							\
+    }									\
+  pre = MALLOC(nspans * nnts * sizeof(VALUE));				\
+  post = MALLOC(nspans * nnts * sizeof(VALUE));				\
+  for (i = 0; i < nspans * nnts; i++)					\
+    pre[i] = post[i] = ZERO;						\
+  inpre = CALLOC(nspans * words, sizeof(bitword));			\
+  inpost = CALLOC(nspans * words, sizeof(bitword));			\
+									\
+  for (len = 1; len <= n; len++)					\
+    for (i = 0; i + len <= n; i++) {					\
+      size_t	s = CKY_SPAN(i, i+len);					\
+      VALUE	*spre = pre + s*nnts, *spost = post + s*nnts;		\
+      bitword	*bpre = inpre + s*words, *bpost = inpost + s*words;	\
+									\
+      k = i + len;							\
+      if (len == 1) {		/* lexical rules */			\
+	urules urs = g->child_urs[term[i]];				\
+									\
+	for (x = 0; x < urs.n; x++) {					\
+	  unsigned a = g->label_id[urs.e[x]->parent];			\
+	  spre[a] = PLUS(spre[a], WEIGHT(urs.e[x]->prob));		\
+	  BITSET_SET(bpre, a);						\
+	}}								\
+      else								\
+	for (j = i+1; j < k; j++) {					\
+	  size_t  sl = CKY_SPAN(i, j), sr = CKY_SPAN(j, k);		\
+	  bitword *lin = inpost + sl*words;				\
+	  unsigned rterm = k == j+1 ? term[j] : NO_ID;			\
+									\
+	  for (b = bitset_next_and(lin, g->left_nts, 0, nnts); b < nnts; \
+	       b = bitset_next_and(lin, g->left_nts, b+1, nnts))	\
+	    CKY ## _binary(sg, b, post[sl*nnts + b], post + sr*nnts,	\
+			   inpost + sr*words, rterm, spre, bpre);	\
+	  if (j == i+1)		/* the word is a left child */		\
+	    CKY ## _binary(sg, term[i], ONE, post + sr*nnts,		\
+			   inpost + sr*words, rterm, spre, bpre);	\
+	}								\
+									\
+      /* unary closure */						\
+      for (b = bitset_next(bpre, 0, nnts); b < nnts;			\
+	   b = bitset_next(bpre, b+1, nnts)) {				\
+	for (x = sg->unary->start[b]; x < sg->unary->start[b+1]; x++) { \
+	  unsigned a = sg->unary->sums[x].to;				\
+	  spost[a] = PLUS(spost[a], TIMES(spre[b], sg->uweight[x]));	\
+	  BITSET_SET(bpost, a);						\
+	}}								\
+    }									\
+									\
+  if (BITSET_TEST(inpost + CKY_SPAN(0, n)*words, 0))	/* the root */	\
+    result = post[CKY_SPAN(0, n)*nnts];					\
+									\
+  FREE(term);								\
+  FREE(pre);								\
+  FREE(post);								\
+  FREE(inpre);								\
+  FREE(inpost);								\
+  return result;							\
+}
@@ -0,0 +1,424 @@
+/* closure.c -- sums over the paths of a weighted graph
+ *
+ * The components are found with Tarjan's algorithm (without recursion,
+ * since left corner chains can be long).  It finishes each component
+ * after every component it has edges into, so the components above a
+ * node are summed in the reverse of the order they were finished in.
+ *
+ * Within a component whose path sums converge I - W is an M-matrix,
+ * so Gauss-Jordan elimination needs no pivoting, and since every node
+ * of the component has paths to every other its inverse is positive: a
+ * pivot or an entry of the inverse that isn't positive means the sums
+ * diverge.
+ */
+
+#include "closure.h"
+#include "mmm.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX(x,y)		((x) < (y) ? (y) : (x))
+#define UNVISITED		UINT_MAX
+#define CLOSURE_ITERATIONS	10000	/* before a big component diverges */
+#define CLOSURE_EPSILON		1e-13	/* relative change of a converged sum */
+
+static int
+closure_edge_cmp(const void *p1, const void *p2)
+{
+  const closure_edge *e1 = p1, *e2 = p2;
+
+  if (e1->from != e2->from)
+    return e1->from < e2->from ? -1 : 1;
+  if (e1->to != e2->to)
+    return e1->to < e2->to ? -1 : 1;
+  return 0;
+}
+
+/* The graph, with its edges sorted by the node they leave, and its
+ * components numbered in the order they were finished.
+ */
+
+typedef struct graph {
+  size_t	n, ncomps;
+  size_t	*out_start;	/* node id's edges are ... */
+  closure_edge	*out;		/* ... these */
+  unsigned	*comp;		/* component of each node */
+  size_t	*comp_start;	/* component c's nodes are ... */
+  unsigned	*comp_nodes;	/* ... these */
+  unsigned	*local;		/* index of each node in its component */
+  char		*cyclic;	/* does component c have a path of one edge or more to itself? */
+  FLOAT		**inverse;	/* (I - W)^-1 of small cyclic components */
+  char		*diverges;	/* do their path sums diverge? */
+} graph;
+
+/* find_components() numbers the strongly connected components of gr */
+static void
+find_components(graph *gr)
+{
+  size_t	n = gr->n, nindex = 0, nstack = 0, ncalls = 0, v, c;
+  unsigned	*index = MALLOC(n * sizeof(unsigned));
+  unsigned	*low = MALLOC(n * sizeof(unsigned));
+  unsigned	*stack = MALLOC(n * sizeof(unsigned));
+  char		*on_stack = CALLOC(n, sizeof(char));
+  struct call { unsigned v; size_t e; } *calls = MALLOC(n * sizeof(struct call));
+
+  gr->ncomps = 0;
+  for (v = 0; v < n; v++)
+    index[v] = UNVISITED;
+
+#define VISIT(w)						\
+  do { index[w] = low[w] = nindex++;				\
+    stack[nstack++] = w;					\
+    on_stack[w] = 1;						\
+    calls[ncalls].v = w;					\
+    calls[ncalls++].e = gr->out_start[w]; } while (0)
+
+  for (v = 0; v < n; v++) {
+    if (index[v] != UNVISITED)
+      continue;
+    VISIT(v);
+    while (ncalls > 0) {
+      struct call *top = &calls[ncalls-1];
+      unsigned    u = top->v;
+
+      if (top->e < gr->out_start[u+1]) {
+        unsigned w = gr->out[top->e++].to;
+
+        if (index[w] == UNVISITED)
+          VISIT(w);
+        else if (on_stack[w] && index[w] < low[u])
+          low[u] = index[w];
+        continue;
+      }
+      if (--ncalls > 0 && low[u] < low[calls[ncalls-1].v])
+        low[calls[ncalls-1].v] = low[u];
+      if (low[u] == index[u]) {	/* u is the root of a component */
+        unsigned w;
+
+        do {
+          w = stack[--nstack];
+          on_stack[w] = 0;
+          gr->comp[w] = gr->ncomps;
+        } while (w != u);
+        gr->ncomps++;
+      }}}
+#undef VISIT
+
+  gr->comp_start = CALLOC(gr->ncomps + 1, sizeof(size_t));
+  gr->comp_nodes = MALLOC(MAX(n, 1) * sizeof(unsigned));
+  for (v = 0; v < n; v++)
+    gr->comp_start[gr->comp[v] + 1]++;
+  for (c = 0; c < gr->ncomps; c++)
+    gr->comp_start[c+1] += gr->comp_start[c];
+  for (c = 0; c < gr->ncomps; c++)	/* low is free now, so it counts */
+    low[c] = 0;
+  for (v = 0; v < n; v++) {
+    c = gr->comp[v];
+    gr->local[v] = low[c]++;
+    gr->comp_nodes[gr->comp_start[c] + gr->local[v]] = v;
+  }
+
+  FREE(index);
+  FREE(low);
+  FREE(stack);
+  FREE(on_stack);
+  FREE(calls);
+}
+
+/* invert_component() computes (I - W)^-1 of the small cyclic
+ * component c, whose node i's sums are row i, or notes that its sums
+ * diverge.
+ */
+static void
+invert_component(graph *gr, size_t c)
+{
+  size_t m = gr->comp_start[c+1] - gr->comp_start[c], i, j, b, e;
+  FLOAT	 *a = CALLOC(m * m, sizeof(FLOAT));
+  FLOAT	 *inv = CALLOC(m * m, sizeof(FLOAT));
+
+  for (i = 0; i < m; i++) {
+    unsigned x = gr->comp_nodes[gr->comp_start[c] + i];
+
+    a[i*m + i] += 1;
+    inv[i*m + i] = 1;
+    for (e = gr->out_start[x]; e < gr->out_start[x+1]; e++)
+      if (gr->comp[gr->out[e].to] == c)	/* the paths into y through x */
+        a[gr->local[gr->out[e].to]*m + i] -= gr->out[e].weight;
+  }
+
+  for (j = 0; j < m && !gr->diverges[c]; j++) {
+    FLOAT pivot = a[j*m + j];
+
+    if (!(pivot > 0)) {
+      gr->diverges[c] = 1;
+      break;
+    }
+    for (b = 0; b < m; b++) {
+      a[j*m + b] /= pivot;
+      inv[j*m + b] /= pivot;
+    }
+    for (i = 0; i < m; i++) {
+      FLOAT f = a[i*m + j];
+
+      if (i == j || f == 0)
+        continue;
+      for (b = 0; b < m; b++) {
+        a[i*m + b] -= f * a[j*m + b];
+        inv[i*m + b] -= f * inv[j*m + b];
+      }}}
+  for (i = 0; i < m*m && !gr->diverges[c]; i++)
+    if (!(inv[i] > 0))
+      gr->diverges[c] = 1;
+
+  FREE(a);
+  if (gr->diverges[c])
+    FREE(inv);
+  else
+    gr->inverse[c] = inv;
+}
+
+/* iterate_component() sets val of the nodes of the big component c to
+ * the sums of the paths into them from acc, by iterating
+ * val = acc + W val.  It returns 0 if the sums diverge.
+ */
+static int
+iterate_component(const graph *gr, size_t c, const FLOAT *acc, FLOAT *val,
+                  FLOAT *next)
+{
+  size_t   first = gr->comp_start[c], last = gr->comp_start[c+1], i, e, t;
+  unsigned x;
+
+  for (i = first; i < last; i++)
+    val[gr->comp_nodes[i]] = acc[gr->comp_nodes[i]];
+  for (t = 0; t < CLOSURE_ITERATIONS; t++) {
+    int converged = 1;
+
+    for (i = first; i < last; i++)
+      next[gr->comp_nodes[i]] = acc[gr->comp_nodes[i]];
+    for (i = first; i < last; i++)
+      for (x = gr->comp_nodes[i], e = gr->out_start[x]; e < gr->out_start[x+1]; e++)
+        if (gr->comp[gr->out[e].to] == c)
+          next[gr->out[e].to] += gr->out[e].weight * val[x];
+    for (i = first; i < last; i++) {
+      x = gr->comp_nodes[i];
+      if (next[x] > 1e300)
+        return 0;
+      if (next[x] - val[x] > CLOSURE_EPSILON * next[x])
+        converged = 0;
+      val[x] = next[x];
+    }
+    if (converged)
+      return 1;
+  }
+  return 0;
+}
+
+static int
+comp_cmp(const void *p1, const void *p2)
+{
+  unsigned c1 = *(const unsigned *) p1, c2 = *(const unsigned *) p2;
+
+  return c1 < c2 ? 1 : c1 > c2 ? -1 : 0;	/* last finished first */
+}
+
+sum_closure
+make_sum_closure(size_t n, const closure_edge *edges, size_t nedges)
+{
+  sum_closure	sc = MALLOC(sizeof(struct sum_closure));
+  graph		gr;
+  size_t	i, e, k, m, nsums = 0, nsize = MAX(2*n, 1);
+  size_t	nreached, ncomps;
+  unsigned	v, x, *reached = MALLOC(MAX(n, 1) * sizeof(unsigned));
+  unsigned	*comps = MALLOC(MAX(n, 1) * sizeof(unsigned));
+  char		*seen = CALLOC(MAX(n, 1), sizeof(char));
+  char		*comp_seen;
+  FLOAT		*acc = CALLOC(MAX(n, 1), sizeof(FLOAT));
+  FLOAT		*val = CALLOC(MAX(n, 1), sizeof(FLOAT));
+  FLOAT		*next = MALLOC(MAX(n, 1) * sizeof(FLOAT));
+
+  /* the edges, by the node they leave, with duplicates added up */
+
+  gr.n = n;
+  gr.out = MALLOC(MAX(nedges, 1) * sizeof(closure_edge));
+  memcpy(gr.out, edges, nedges * sizeof(closure_edge));
+  qsort(gr.out, nedges, sizeof(closure_edge), closure_edge_cmp);
+  for (k = 0, e = 0; e < nedges; e++)
+    if (k > 0 && gr.out[k-1].from == gr.out[e].from && gr.out[k-1].to == gr.out[e].to)
+      gr.out[k-1].weight += gr.out[e].weight;
+    else
+      gr.out[k++] = gr.out[e];
+  nedges = k;
+  gr.out_start = CALLOC(n + 1, sizeof(size_t));
+  for (e = 0; e < nedges; e++)
+    gr.out_start[gr.out[e].from + 1]++;
+  for (v = 0; v < n; v++)
+    gr.out_start[v+1] += gr.out_start[v];
+
+  gr.comp = MALLOC(MAX(n, 1) * sizeof(unsigned));
+  gr.local = MALLOC(MAX(n, 1) * sizeof(unsigned));
+  find_components(&gr);
+
+  gr.cyclic = CALLOC(gr.ncomps + 1, sizeof(char));
+  gr.diverges = CALLOC(gr.ncomps + 1, sizeof(char));
+  gr.inverse = CALLOC(gr.ncomps + 1, sizeof(FLOAT *));
+  comp_seen = CALLOC(gr.ncomps + 1, sizeof(char));
+  for (e = 0; e < nedges; e++)
+    if (gr.comp[gr.out[e].from] == gr.comp[gr.out[e].to])
+      gr.cyclic[gr.comp[gr.out[e].from]] = 1;
+  for (k = 0; k < gr.ncomps; k++)
+    if (gr.cyclic[k] && gr.comp_start[k+1] - gr.comp_start[k] <= CLOSURE_DENSE_MAX)
+      invert_component(&gr, k);
+
+  sc->n = n;
+  sc->start = MALLOC((n + 1) * sizeof(size_t));
+  sc->sums = MALLOC(nsize * sizeof(path_sum));
+
+  for (v = 0; v < n; v++) {
+    sc->start[v] = nsums;
+
+    /* the nodes above v, and their components */
+    reached[0] = v;
+    seen[v] = 1;
+    nreached = 1;
+    ncomps = 0;
+    for (i = 0; i < nreached; i++) {
+      x = reached[i];
+      if (!comp_seen[gr.comp[x]]) {
+        comp_seen[gr.comp[x]] = 1;
+        comps[ncomps++] = gr.comp[x];
+      }
+      for (e = gr.out_start[x]; e < gr.out_start[x+1]; e++)
+        if (!seen[gr.out[e].to]) {
+          seen[gr.out[e].to] = 1;
+          reached[nreached++] = gr.out[e].to;
+        }}
+    qsort(comps, ncomps, sizeof(unsigned), comp_cmp);
+
+    acc[v] = 1;
+    for (k = 0; k < ncomps; k++) {
+      unsigned c = comps[k];
+      size_t   first = gr.comp_start[c], last = gr.comp_start[c+1];
+
+      m = last - first;
+      if (!gr.cyclic[c])
+        val[gr.comp_nodes[first]] = acc[gr.comp_nodes[first]];
+      else if (gr.diverges[c]
+               || (!gr.inverse[c] && !iterate_component(&gr, c, acc, val, next)))
+        for (i = first; i < last; i++)
+          val[gr.comp_nodes[i]] = HUGE_VAL;
+      else if (gr.inverse[c]) {
+        const FLOAT *inv = gr.inverse[c];
+        size_t	    j;
+
+        for (i = 0; i < m; i++) {
+          FLOAT s = 0;
+
+          for (j = 0; j < m; j++)
+            s += inv[i*m + j] * acc[gr.comp_nodes[first + j]];
+          val[gr.comp_nodes[first + i]] = s;
+        }}
+
+      for (i = first; i < last; i++) {
+        x = gr.comp_nodes[i];
+        if (!(val[x] > 0))
+          continue;
+        if (nsums >= nsize) {
+          nsize *= 2;
+          sc->sums = REALLOC(sc->sums, nsize * sizeof(path_sum));
+        }
+        sc->sums[nsums].to = x;
+        sc->sums[nsums++].sum = val[x];
+        if (x == v && nsums - 1 > sc->start[v]) {	/* v goes first */
+          path_sum tmp = sc->sums[sc->start[v]];
+
+          sc->sums[sc->start[v]] = sc->sums[nsums-1];
+          sc->sums[nsums-1] = tmp;
+        }
+        for (e = gr.out_start[x]; e < gr.out_start[x+1]; e++)
+          if (gr.comp[gr.out[e].to] != c)
+            acc[gr.out[e].to] += val[x] * gr.out[e].weight;
+      }}
+
+    for (i = 0; i < nreached; i++) {
+      x = reached[i];
+      seen[x] = 0;
+      comp_seen[gr.comp[x]] = 0;
+      acc[x] = val[x] = 0;
+    }}
+  sc->start[n] = nsums;
+  sc->sums = REALLOC(sc->sums, MAX(nsums, 1) * sizeof(path_sum));
+
+  for (k = 0; k < gr.ncomps; k++)
+    if (gr.inverse[k])
+      FREE(gr.inverse[k]);
+  FREE(gr.inverse);
+  FREE(gr.cyclic);
+  FREE(gr.diverges);
+  FREE(gr.out);
+  FREE(gr.out_start);
+  FREE(gr.comp);
+  FREE(gr.local);
+  FREE(gr.comp_start);
+  FREE(gr.comp_nodes);
+  FREE(comp_seen);
+  FREE(reached);
+  FREE(comps);
+  FREE(seen);
+  FREE(acc);
+  FREE(val);
+  FREE(next);
+  return sc;
+}
+
+void
+free_sum_closure(sum_closure sc)
+{
+  FREE(sc->start);
+  FREE(sc->sums);
+  FREE(sc);
+}
+
+sum_closure
+unary_sum_closure(const grammar *g, int count)
+{
+  size_t	 nedges = 0, id, i;
+  closure_edge	 *edges;
+  sum_closure	 sc;
+
+  for (id = 0; id < g->nnts; id++)
+    nedges += g->child_urs[id].n;
+  edges = MALLOC(MAX(nedges, 1) * sizeof(closure_edge));
+  for (nedges = 0, id = 0; id < g->nnts; id++)
+    for (i = 0; i < g->child_urs[id].n; i++) {
+      edges[nedges].from = id;
+      edges[nedges].to = g->label_id[g->child_urs[id].e[i]->parent];
+      edges[nedges++].weight = count ? 1 : exp(g->child_urs[id].e[i]->prob);
+    }
+  sc = make_sum_closure(g->nnts, edges, nedges);
+  FREE(edges);
+  return sc;
+}
+
+sum_closure
+unary_best_closure(const grammar *g)
+{
+  sum_closure sc = MALLOC(sizeof(struct sum_closure));
+  size_t      nchains = g->uchains_start[g->nnts], id, i;
+
+  sc->n = g->nnts;
+  sc->start = MALLOC((g->nnts + 1) * sizeof(size_t));
+  sc->sums = MALLOC((nchains + g->nnts + 1) * sizeof(path_sum));
+  for (id = 0; id < g->nnts; id++) {
+    sc->start[id] = id + g->uchains_start[id];
+    sc->sums[sc->start[id]].to = id;	/* the empty chain */
+    sc->sums[sc->start[id]].sum = 0.0;
+    for (i = g->uchains_start[id]; i < g->uchains_start[id+1]; i++) {
+      sc->sums[id + 1 + i].to = g->uchains[i].parent;
+      sc->sums[id + 1 + i].sum = g->uchains[i].prob;
+    }}
+  sc->start[g->nnts] = g->nnts + nchains;
+  return sc;
+}
@@ -0,0 +1,67 @@
+/* closure.h -- sums over the paths of a weighted graph
+ *
+ * A unary rule A --> B can be read as an edge from B up to A weighted
+ * by the rule's probability, and the left corner relation as an edge
+ * from each left corner up to its parent.  The total weight of the
+ * paths from every node to every node above it (the empty path
+ * included) is then the matrix (I - W)^-1 = I + W + W^2 + ... of the
+ * edge weights W, which is what the sum semirings need where the
+ * Viterbi parser takes the best chain (see close_unary()).
+ *
+ * make_sum_closure() splits the graph into strongly connected
+ * components, inverts I - W only within each component, and sums the
+ * paths from each node through the components above it in topological
+ * order, so its cost is proportional to the pairs of connected nodes
+ * plus the cube of the (usually tiny) components.  Components with
+ * more than CLOSURE_DENSE_MAX nodes are solved by fixed-point
+ * iteration over their edges instead.  If the sum of the paths
+ * through a component diverges (as the number of paths around a cycle
+ * does) the sums through it are HUGE_VAL.
+ */
+
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "lgrammar.h"
+
+#define CLOSURE_DENSE_MAX	1024	/* larger components are iterated */
+
+typedef struct closure_edge {
+  unsigned	from, to;
+  FLOAT		weight;
+} closure_edge;
+
+typedef struct path_sum {
+  unsigned	to;
+  FLOAT		sum;
+} path_sum;
+
+/* The paths from node id are sums[start[id]] .. sums[start[id+1]-1],
+ * the first of which is the paths from id to itself.
+ */
+
+typedef struct sum_closure {
+  size_t	n;
+  size_t	*start;
+  path_sum	*sums;
+} *sum_closure;
+
+/* make_sum_closure() sums the paths of the graph with nodes 0..n-1 and
+ * the nedges edges; edges with the same ends are added together.
+ */
+sum_closure make_sum_closure(size_t n, const closure_edge *edges, size_t nedges);
+void free_sum_closure(sum_closure sc);
+
+/* unary_sum_closure() sums g's chains of unary rules between
+ * nonterminals, weighting each rule by its probability, or by 1 if
+ * count is set (so the sums count the chains).
+ */
+sum_closure unary_sum_closure(const grammar *g, int count);
+
+/* unary_best_closure() puts g's closure table (see close_unary()) in
+ * the same form, so its "sums" are the log probs of the best chains
+ * (0 for the empty chain).
+ */
+sum_closure unary_best_closure(const grammar *g);
+
+#endif
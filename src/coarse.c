@@ -0,0 +1,99 @@
+/* coarse.c -- coarse-to-fine pruning
+ *
+ * The coarse parse computes the posteriors of the coarse labels with
+ * inside_outside() (see inout.c), and allows the fine labels of the
+ * (span, coarse label) pairs whose posterior reaches the threshold.
+ */
+
+#include "coarse.h"
+#include "mmm.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+coarse
+make_coarse(FILE *fp, const grammar *fine, si_t si, double threshold)
+{
+  coarse   cg = MALLOC(sizeof(struct coarse));
+  size_t   i;
+
+  rewind(fp);
+  cg->g = read_coarse_grammar(fp, si);
+  cg->nfine = fine->nnts;
+  cg->fine_coarse = MALLOC(fine->nnts * sizeof(unsigned));
+  for (i = 0; i < fine->nnts; i++)
+    cg->fine_coarse[i] =
+      grammar_label_id(&cg->g, project_label(fine->id_label[i], si));
+  cg->threshold = threshold;
+  cg->ig = make_inout_grammar(&cg->g);
+  return cg;
+}
+
+void
+free_coarse(coarse cg)
+{
+  free_inout_grammar(cg->ig);
+  free_grammar(cg->g);
+  FREE(cg->fine_coarse);
+  FREE(cg);
+}
+
+void
+free_coarse_mask(coarse_mask m)
+{
+  FREE(m->allowed);
+  FREE(m->spans);
+  FREE(m);
+}
+
+void
+coarse_mask_and(coarse_mask m, const struct coarse_mask *other)
+{
+  size_t	n = m->n, i, k, w;
+
+  assert(other->n == n && other->words == m->words);
+  m->parsed = m->parsed && other->parsed;
+  memset(m->spans, 0, (n+1) * BITSET_BYTES(n+1));
+  for (k = 1; k <= n; k++)
+    for (i = 0; i < k; i++) {
+      bitword       *allowed = COARSE_ALLOWED(m, i, k);
+      const bitword *also = COARSE_ALLOWED(other, i, k);
+      bitword       any = 0;
+
+      for (w = 0; w < m->words; w++)
+        any |= allowed[w] &= also[w];
+      if (any)
+        BITSET_SET(COARSE_SPAN_ROW(m, i), k);
+    }
+}
+
+coarse_mask
+coarse_prune(coarse cg, const struct vindex *terms)
+{
+  size_t	n = terms->n, nspans = n*(n+1)/2, i, k, id;
+  coarse_mask	m = MALLOC(sizeof(struct coarse_mask));
+  posteriors	p = inside_outside(cg->ig, terms);
+
+  m->n = n;
+  m->parsed = p->lprob > LOG_ZERO;
+  m->words = BITSET_WORDS(cg->nfine);
+  m->allowed = CALLOC(nspans * m->words, sizeof(bitword));
+  m->spans = CALLOC(n+1, BITSET_BYTES(n+1));
+
+  if (m->parsed)
+    for (k = 1; k <= n; k++)
+      for (i = 0; i < k; i++) {
+        FLOAT	*post = POSTERIORS(p, i, k);
+        bitword *allowed = COARSE_ALLOWED(m, i, k);
+
+        for (id = 0; id < cg->nfine; id++) {
+          unsigned cid = cg->fine_coarse[id];
+
+          if (cid != NO_ID && post[cid] > 0 && post[cid] >= cg->threshold) {
+            BITSET_SET(allowed, id);
+            BITSET_SET(COARSE_SPAN_ROW(m, i), k);
+          }}}
+  free_posteriors(p);
+  return m;
+}
@@ -0,0 +1,59 @@
+/* coarse.h -- coarse-to-fine pruning
+ *
+ * A coarse grammar is read from the same grammar file with parent
+ * annotations projected away (see read_coarse_grammar()).  Each
+ * sentence is parsed with it first, and the posterior probability of
+ * every (span, coarse label) pair is computed by inside-outside.  The
+ * fine parse then only builds cells whose label projects onto a coarse
+ * label with posterior at least the threshold.
+ *
+ * The resulting mask is in terms of fine labels, so other prepasses
+ * (see recognize.h) can produce masks too, and masks can be combined.
+ */
+
+#ifndef COARSE_H
+#define COARSE_H
+
+#include "lgrammar.h"
+#include "vindex.h"
+#include "bitset.h"
+#include "inout.h"
+
+typedef struct coarse {
+  grammar	g;		/* the coarse grammar */
+  unsigned	*fine_coarse;	/* coarse id of each fine nonterminal id */
+  size_t	nfine;		/* number of fine nonterminals */
+  FLOAT		threshold;	/* the posterior threshold */
+  inout_grammar	ig;		/* g's rule probabilities */
+} *coarse;
+
+/* The allowed (fine) labels of a sentence of length n.  Spans are
+ * numbered as in the chart, span (i, j) being j*(j-1)/2+i.
+ */
+
+typedef struct coarse_mask {
+  size_t	n;
+  int		parsed;		/* non-zero iff the prepass found a parse */
+  size_t	words;		/* bitwords per span */
+  bitword	*allowed;	/* allowed fine label ids of each span */
+  bitword	*spans;		/* row i has bit j set iff i..j is allowed */
+} *coarse_mask;
+
+#define COARSE_SPAN(i, j)		INOUT_SPAN(i, j)
+#define COARSE_ALLOWED(m, i, j)		((m)->allowed + COARSE_SPAN(i, j)*(m)->words)
+#define COARSE_SPAN_ROW(m, i)		((m)->spans + (i)*BITSET_WORDS((m)->n+1))
+
+coarse make_coarse(FILE *fp, const grammar *fine, si_t si, double threshold);
+void free_coarse(coarse cg);
+
+/* coarse_prune() parses terms with the coarse grammar and returns the
+ * mask of allowed labels, which is empty if there is no coarse parse
+ * (and so no fine parse either).
+ */
+coarse_mask coarse_prune(coarse cg, const struct vindex *terms);
+void free_coarse_mask(coarse_mask m);
+
+/* coarse_mask_and() restricts m to the labels other allows as well */
+void coarse_mask_and(coarse_mask m, const struct coarse_mask *other);
+
+#endif
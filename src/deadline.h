@@ -0,0 +1,31 @@
+/* deadline.h -- abandoning parses that run too long
+ *
+ * A parse still running at deadline (a server request's timeout, or 0
+ * for none) is abandoned: the parsers and their prepasses (recognize(),
+ * inside_outside()) check PAST_DEADLINE between spans, stop building
+ * their charts once it is true and set timed_out, so the sentence gets
+ * no parse.  Both are per thread; llncky.c defines them.
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <time.h>
+
+extern __thread double	deadline;
+extern __thread int	timed_out;
+
+/* seconds() reads clock, CLOCK_MONOTONIC or CLOCK_THREAD_CPUTIME_ID */
+static inline double
+seconds(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#define PAST_DEADLINE	(deadline > 0 && (timed_out \
+                          || (timed_out = seconds(CLOCK_MONOTONIC) > deadline)))
+
+#endif
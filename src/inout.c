@@ -0,0 +1,359 @@
+/* inout.c -- inside-outside posteriors
+ *
+ * Inside and outside scores are kept in dense arrays, one array of
+ * nonterminals per span.  Each span has two layers: pre holds the
+ * scores of the labels built by binary (or lexical) rules, and post the
+ * scores after unary closure.  Unary rules are applied through the sum
+ * closure of the grammar's unary rules (see closure.h), so each (child,
+ * ancestor) pair is scored by the total probability of all the chains
+ * between them, where the Viterbi parser takes the best.  The outside
+ * pass runs over the arrays left by the inside pass.
+ *
+ * Scores are probabilities rather than log probs, so that log-sum-exp
+ * is a multiply-add and there is no exp() or log() per rule.  To avoid
+ * underflow the scores of each span are scaled: the inside score of
+ * label A over span s is ins[s][A] * exp(iscale[s]), and likewise for
+ * outside scores.  Rescaling a span is a loop over a contiguous array.
+ */
+
+#include "inout.h"
+#include "mmm.h"
+#include "deadline.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+inout_grammar
+make_inout_grammar(const grammar *g)
+{
+  inout_grammar ig = MALLOC(sizeof(struct inout_grammar));
+  size_t	nbparents = g->bpairs[g->nbpairs].start, i;
+
+  ig->g = g;
+  ig->bprob = MALLOC((nbparents + 1) * sizeof(FLOAT));
+  for (i = 0; i < nbparents; i++)
+    ig->bprob[i] = exp(g->bparents[i].prob);
+  ig->unary = unary_sum_closure(g, 0);
+  return ig;
+}
+
+void
+free_inout_grammar(inout_grammar ig)
+{
+  FREE(ig->bprob);
+  free_sum_closure(ig->unary);
+  FREE(ig);
+}
+
+void
+free_posteriors(posteriors p)
+{
+  FREE(p->post);
+  FREE(p);
+}
+
+
+/* The working storage for one sentence */
+
+typedef struct iochart {
+  inout_grammar	ig;
+  size_t	n, nnts, words;
+  unsigned	*term;		/* id of each word */
+  FLOAT		*ins_pre, *ins_post, *out_pre, *out_post;
+  FLOAT		*iscale, *oscale;	/* log scale of each span */
+  bitword	*pre, *post;	/* labels with inside scores */
+} iochart;
+
+#define SCORE(cc, a, s, id)	((cc)->a[(s)*(cc)->nnts + (id)])
+#define SCORES(cc, a, s)	((cc)->a + (s)*(cc)->nnts)
+#define LABELS(cc, a, s)	((cc)->a + (s)*(cc)->words)
+
+/* close_span() scales the pre layer of span s so its largest score is
+ * 1, and fills the post layer from it.
+ */
+static void
+close_span(iochart *cc, const grammar *g, size_t s, FLOAT scale)
+{
+  bitword *pre = LABELS(cc, pre, s), *post = LABELS(cc, post, s);
+  FLOAT	  *ins_pre = SCORES(cc, ins_pre, s), *ins_post = SCORES(cc, ins_post, s);
+  FLOAT	  max = 0, norm;
+  size_t  b, i;
+
+  for (b = 0; b < g->nnts; b++)
+    if (ins_pre[b] > max)
+      max = ins_pre[b];
+  if (max == 0) {		/* only a terminal, if anything */
+    cc->iscale[s] = scale;
+    return;
+  }
+  cc->iscale[s] = scale + log(max);
+  norm = 1 / max;
+  for (b = 0; b < g->nnts; b++)
+    ins_pre[b] *= norm;
+
+  for (b = bitset_next(pre, 0, g->nnts); b < g->nnts;
+       b = bitset_next(pre, b+1, g->nnts)) {
+    FLOAT	   x = ins_pre[b];
+    const path_sum *ps = cc->ig->unary->sums;
+
+    for (i = cc->ig->unary->start[b]; i < cc->ig->unary->start[b+1]; i++) {
+      BITSET_SET(post, ps[i].to);
+      ins_post[ps[i].to] += x * ps[i].sum;
+    }}}
+
+/* right_score() returns the scaled inside score of right child id in
+ * span j..k, or 0 if it is absent.
+ */
+static inline FLOAT
+right_score(const iochart *cc, unsigned id, size_t j, size_t k)
+{
+  if (id < cc->nnts)
+    return BITSET_TEST(LABELS(cc, post, INOUT_SPAN(j, k)), id) ?
+      SCORE(cc, ins_post, INOUT_SPAN(j, k), id) : 0;
+  /* a terminal's inside score is 1 */
+  return k == j+1 && id == cc->term[j] ? exp(-cc->iscale[INOUT_SPAN(j, k)]) : 0;
+}
+
+/* binary_inside() adds the parents of left child b (in i..j, with
+ * inside score lscore) to the pre layer of i..k.
+ */
+static void
+binary_inside(iochart *cc, const grammar *g, unsigned b, FLOAT lscore,
+              size_t i, size_t j, size_t k)
+{
+  size_t	s = INOUT_SPAN(i, k);
+  const bpair	*bp, *end = g->bpairs + g->bleft_start[b+1];
+  FLOAT		*ins_pre = SCORES(cc, ins_pre, s);
+  bitword	*pre = LABELS(cc, pre, s);
+
+  for (bp = g->bpairs + g->bleft_start[b]; bp < end; bp++) {
+    FLOAT	rscore = lscore * right_score(cc, bp->right, j, k);
+    size_t	r;
+
+    if (rscore == 0)
+      continue;
+    for (r = bp->start; r < bp[1].start; r++) {
+      unsigned p = g->label_id[g->bparents[r].parent];
+
+      BITSET_SET(pre, p);
+      ins_pre[p] += rscore * cc->ig->bprob[r];
+    }}}
+
+/* add_outside() prepares the outside scores of span s to take a
+ * contribution with log scale scale, and returns the factor to
+ * multiply it by.
+ */
+static FLOAT
+add_outside(iochart *cc, size_t s, FLOAT scale)
+{
+  FLOAT  *out_post = SCORES(cc, out_post, s), factor;
+  size_t id;
+
+  if (cc->oscale[s] == LOG_ZERO || scale <= cc->oscale[s]) {
+    if (cc->oscale[s] == LOG_ZERO)
+      cc->oscale[s] = scale;
+    return exp(scale - cc->oscale[s]);
+  }
+  factor = exp(cc->oscale[s] - scale);
+  for (id = 0; id < cc->nnts; id++)
+    out_post[id] *= factor;
+  cc->oscale[s] = scale;
+  return 1;
+}
+
+/* binary_outside() passes the outside scores of the parents in i..k
+ * down to left child b (in i..j) and its right siblings in j..k.
+ */
+static void
+binary_outside(iochart *cc, const grammar *g, unsigned b, FLOAT lscore,
+               size_t i, size_t j, size_t k)
+{
+  size_t	s = INOUT_SPAN(i, k), sr = INOUT_SPAN(j, k);
+  const bpair	*bp, *end = g->bpairs + g->bleft_start[b+1];
+  FLOAT		*out_pre = SCORES(cc, out_pre, s);
+  FLOAT		lout = 0, rfactor = 0;
+
+  for (bp = g->bpairs + g->bleft_start[b]; bp < end; bp++) {
+    FLOAT	rscore = right_score(cc, bp->right, j, k), out = 0;
+    size_t	r;
+
+    if (rscore == 0)
+      continue;
+    /* out_pre is 0 for labels absent from the span */
+    for (r = bp->start; r < bp[1].start; r++)
+      out += out_pre[g->label_id[g->bparents[r].parent]] * cc->ig->bprob[r];
+    lout += out * rscore;
+    if (bp->right < cc->nnts && out > 0) {
+      if (rfactor == 0)
+        rfactor = add_outside(cc, sr,
+                              cc->oscale[s] + cc->iscale[INOUT_SPAN(i, j)]);
+      SCORE(cc, out_post, sr, bp->right) += out * lscore * rfactor;
+    }}
+  if (b < cc->nnts && lout > 0)
+    SCORE(cc, out_post, INOUT_SPAN(i, j), b) +=
+      lout * add_outside(cc, INOUT_SPAN(i, j), cc->oscale[s] + cc->iscale[sr]);
+}
+
+/* for_left_children() calls f on every left child in i..j, with its
+ * inside score multiplied by factor.
+ */
+static void
+for_left_children(iochart *cc, const grammar *g, size_t i, size_t j, size_t k,
+                  FLOAT factor,
+                  void (*f)(iochart *, const grammar *, unsigned, FLOAT,
+                            size_t, size_t, size_t))
+{
+  size_t  s = INOUT_SPAN(i, j), b;
+  bitword *post = LABELS(cc, post, s);
+
+  for (b = bitset_next_and(post, g->left_nts, 0, g->nnts); b < g->nnts;
+       b = bitset_next_and(post, g->left_nts, b+1, g->nnts))
+    f(cc, g, b, factor * SCORE(cc, ins_post, s, b), i, j, k);
+  if (j == i+1)
+    f(cc, g, cc->term[i], factor * exp(-cc->iscale[s]), i, j, k);
+}
+
+/* The posterior of A over a span is the expected number of A nodes
+ * over it (its probability, unless A is on a unary cycle), which is
+ * the inside score of A over the span with the chains below it (post
+ * layer) times its outside score with the chains above it (pre layer):
+ * A is counted wherever it is in its unary chain, at the bottom, at
+ * the top or in between.
+ */
+posteriors
+inside_outside(inout_grammar ig, const struct vindex *terms)
+{
+  const grammar	*g = ig->g;
+  size_t	n = terms->n, nspans = n*(n+1)/2, i, j, k, s, len, id;
+  posteriors	p = MALLOC(sizeof(struct posteriors));
+  iochart	cc;
+
+  p->n = n;
+  p->nnts = g->nnts;
+  p->lprob = LOG_ZERO;
+  p->post = CALLOC(nspans * g->nnts, sizeof(FLOAT));
+
+  if (n == 0)
+    return p;
+
+  cc.ig = ig;
+  cc.n = n;
+  cc.nnts = g->nnts;
+  cc.words = BITSET_WORDS(g->nnts);
+  cc.term = MALLOC(n * sizeof(unsigned));
+  for (i = 0; i < n; i++)
+    if ((cc.term[i] = grammar_label_id(g, terms->e[i])) == NO_ID) {
+      FREE(cc.term);		/* unknown word, so no parse */
+      return p;
+    }
+
+  cc.ins_pre = CALLOC(nspans * g->nnts, sizeof(FLOAT));
+  cc.ins_post = CALLOC(nspans * g->nnts, sizeof(FLOAT));
+  cc.out_pre = CALLOC(nspans * g->nnts, sizeof(FLOAT));
+  cc.out_post = CALLOC(nspans * g->nnts, sizeof(FLOAT));
+  cc.iscale = MALLOC(nspans * sizeof(FLOAT));
+  cc.oscale = MALLOC(nspans * sizeof(FLOAT));
+  for (s = 0; s < nspans; s++)
+    cc.iscale[s] = cc.oscale[s] = LOG_ZERO;
+  cc.pre = CALLOC(nspans * cc.words, sizeof(bitword));
+  cc.post = CALLOC(nspans * cc.words, sizeof(bitword));
+
+  /* inside pass */
+
+  for (i = 0; i < n; i++) {
+    urules urs = g->child_urs[cc.term[i]];
+
+    s = INOUT_SPAN(i, i+1);
+    for (j = 0; j < urs.n; j++) {
+      unsigned a = g->label_id[urs.e[j]->parent];
+
+      BITSET_SET(LABELS(&cc, pre, s), a);
+      SCORE(&cc, ins_pre, s, a) += exp(urs.e[j]->prob);
+    }
+    close_span(&cc, g, s, 0.0);
+  }
+
+  for (len = 2; len <= n; len++)
+    for (i = 0; i + len <= n && !PAST_DEADLINE; i++) {
+      FLOAT scale = LOG_ZERO;
+
+      k = i + len;
+      /* each split's scores are rescaled to the best split's scale */
+      for (j = i+1; j < k; j++)
+        if (cc.iscale[INOUT_SPAN(i, j)] + cc.iscale[INOUT_SPAN(j, k)] > scale)
+          scale = cc.iscale[INOUT_SPAN(i, j)] + cc.iscale[INOUT_SPAN(j, k)];
+      for (j = i+1; j < k; j++) {
+        FLOAT split = cc.iscale[INOUT_SPAN(i, j)] + cc.iscale[INOUT_SPAN(j, k)];
+
+        if (split - scale > -700)	/* else exp() underflows */
+          for_left_children(&cc, g, i, j, k, exp(split - scale), binary_inside);
+      }
+      close_span(&cc, g, INOUT_SPAN(i, k), scale);
+    }
+
+  s = INOUT_SPAN(0, n);
+  if (!timed_out && BITSET_TEST(LABELS(&cc, post, s), 0)) {	/* the root has id 0 */
+    p->lprob = log(SCORE(&cc, ins_post, s, 0)) + cc.iscale[s];
+
+    /* outside pass */
+
+    SCORE(&cc, out_post, s, 0) = 1;
+    cc.oscale[s] = 0;
+    for (len = n; len >= 1; len--)
+      for (i = 0; i + len <= n && !PAST_DEADLINE; i++) {
+        bitword *post;
+        FLOAT	*out_pre, *out_post;
+
+        k = i + len;
+        s = INOUT_SPAN(i, k);
+        if (cc.oscale[s] == LOG_ZERO)	/* not part of any parse */
+          continue;
+        post = LABELS(&cc, post, s);
+        out_pre = SCORES(&cc, out_pre, s);
+        out_post = SCORES(&cc, out_post, s);
+        /* the outside of every label in the span, as any link of its
+           chain, for the posteriors */
+        for (id = bitset_next(post, 0, g->nnts); id < g->nnts;
+             id = bitset_next(post, id+1, g->nnts))
+          for (j = ig->unary->start[id]; j < ig->unary->start[id+1]; j++)
+            out_pre[id] += out_post[ig->unary->sums[j].to] * ig->unary->sums[j].sum;
+        for (j = i+1; j < k; j++)
+          for_left_children(&cc, g, i, j, k, 1.0, binary_outside);
+      }
+
+    /* posteriors, unless the deadline cut the outside pass short */
+
+    if (timed_out)
+      p->lprob = LOG_ZERO;
+    for (k = 1; k <= n && !timed_out; k++)
+      for (i = 0; i < k; i++) {
+        FLOAT	*post = POSTERIORS(p, i, k), scale, norm;
+        FLOAT	*ins_post, *out_pre;
+
+        s = INOUT_SPAN(i, k);
+        if (cc.oscale[s] == LOG_ZERO)
+          continue;
+        scale = cc.iscale[s] + cc.oscale[s] - p->lprob;
+        norm = scale < 700 ? exp(scale) : 0;	/* else it overflows */
+        ins_post = SCORES(&cc, ins_post, s);
+        out_pre = SCORES(&cc, out_pre, s);
+        for (id = 0; id < g->nnts; id++) {
+          FLOAT x = ins_post[id] * out_pre[id];
+          if (x <= 0)
+            post[id] = 0;
+          else
+            post[id] = norm > 0 ? x * norm : exp(log(x) + scale);
+        }}
+  }
+
+  FREE(cc.term);
+  FREE(cc.ins_pre);
+  FREE(cc.ins_post);
+  FREE(cc.out_pre);
+  FREE(cc.out_post);
+  FREE(cc.iscale);
+  FREE(cc.oscale);
+  FREE(cc.pre);
+  FREE(cc.post);
+  return p;
+}
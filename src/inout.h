@@ -0,0 +1,52 @@
+/* inout.h -- inside-outside posteriors
+ *
+ * inside_outside() computes the posterior probability of every
+ * (span, nonterminal) pair of a sentence, i.e. the total probability
+ * of the parses with that nonterminal over that span divided by the
+ * total probability of all parses.  It is used by the coarse-to-fine
+ * pruner (coarse.h) and by llncky's posterior mode (-P).
+ */
+
+#ifndef INOUT_H
+#define INOUT_H
+
+#include "lgrammar.h"
+#include "vindex.h"
+#include "bitset.h"
+#include "closure.h"
+
+/* -ffast-math assumes there are no infinities, so log zero is finite */
+
+#define LOG_ZERO	(-1e30)
+
+/* The rule probabilities (rather than log probs) of a grammar */
+
+typedef struct inout_grammar {
+  const grammar	*g;
+  FLOAT		*bprob;		/* probability of each of g->bparents */
+  sum_closure	unary;		/* total probability of the unary chains */
+} *inout_grammar;
+
+inout_grammar make_inout_grammar(const grammar *g);
+void free_inout_grammar(inout_grammar ig);
+
+/* Spans are numbered as in the chart, span (i, j) being j*(j-1)/2+i */
+
+#define INOUT_SPAN(i, j)	((j)*((j)-1)/2+(i))
+
+typedef struct posteriors {
+  size_t	n, nnts;
+  FLOAT		lprob;		/* log prob of the sentence, or LOG_ZERO */
+  FLOAT		*post;		/* POSTERIORS(p, i, j)[id] */
+} *posteriors;
+
+#define POSTERIORS(p, i, j)	((p)->post + INOUT_SPAN(i, j)*(p)->nnts)
+
+/* inside_outside() returns the posteriors of terms, which are all 0
+ * (and lprob LOG_ZERO) if terms has no parse or the deadline passed
+ * (see deadline.h).
+ */
+posteriors inside_outside(inout_grammar ig, const struct vindex *terms);
+void free_posteriors(posteriors p);
+
+#endif
@@ -4,8 +4,8 @@
 #include "local-trees.h"
 #include "tree.h"
 
-typedef unsigned short	stringpos;
-#define STRINGPOSMAX	USHRT_MAX
+typedef unsigned int	stringpos;
+#define STRINGPOSMAX	UINT_MAX
 
 struct ledge {
   stringpos	left, right;
@@ -7,6 +7,7 @@
 #include "local-trees.h"
 #include "hash.h"
 #include "hash-string.h"
+#include "bitset.h"
 
 typedef struct brule {
   si_index	parent, left, right;
@@ -28,24 +29,105 @@ typedef struct urules {
   size_t        nsize, n;
 } urules;
 
+/* A uchain is an entry in the unary closure table: the best chain of
+ * unary rules from some child up to parent.  below is the label
+ * immediately below parent on that chain (the child itself if the
+ * chain is a single rule), so the chain can be rebuilt top-down.
+ */
+
+typedef struct uchain {
+  unsigned	parent, below;	/* compact ids */
+  FLOAT		prob;
+} uchain;
+
+/* The parser reads binary rules from a packed copy of g.brs, sorted
+ * by (left, right, parent) id.  The child pairs with left child id are
+ * bpairs[bleft_start[id]] .. bpairs[bleft_start[id+1]-1], and the
+ * parents of pair k are bparents[bpairs[k].start] .. 
+ * bparents[bpairs[k+1].start-1] (there is a sentinel pair at the end).
+ */
+
+typedef struct bpair {
+  unsigned	right;		/* compact id of the right child */
+  unsigned	start;		/* first parent of this pair in bparents[] */
+} bpair;
+
+typedef struct bparent {
+  si_index	parent;
+  FLOAT		prob;
+} bparent;
+
 HASH_HEADER(sihashurs, si_index, urules)
 HASH_HEADER(sihashbrs, si_index, brules)
 
 /* HASH_HEADER_ADD(sihashst, si_index, size_t) */
 HASH_HEADER_ADD(sihashf, si_index, FLOAT)
 
+/* Every label in the grammar gets a compact id at load time.
+ * Nonterminals (labels that are the parent of some rule) are
+ * numbered 0..nnts-1 and terminals nnts..nnts+nterms-1, so that
+ * arrays indexed by nonterminal stay small even for grammars with
+ * large vocabularies.
+ */
+
+#define NO_ID		UINT_MAX	/* id of a label not in the grammar */
+
 typedef struct grammar {
   sihashurs     parent_urs;
   sihashurs	urs;
   sihashbrs	brs;
   si_index      root_label;
+  size_t	nnts, nterms;	/* number of nonterminals and terminals */
+  size_t	nlabels;	/* size of label_id[] */
+  unsigned	*label_id;	/* label_id[label] is label's compact id */
+  si_index	*id_label;	/* id_label[id] is the label with this id */
+  size_t	nbpairs;	/* number of binary child pairs */
+  size_t	*bleft_start;	/* left child id's pairs start here ... */
+  bpair		*bpairs;	/* ... in this array */
+  bparent	*bparents;	/* parents of each pair, by pair */
+  unsigned	*bpair_left;	/* left child id of each pair */
+  size_t	*bright_start;	/* right child id's pairs are ... */
+  unsigned	*bright_pairs;	/* ... these indices into bpairs[] */
+  urules	*child_urs;	/* child_urs[id] shares g.urs's rules for id */
+  bitword	*left_nts;	/* nonterminals that are binary left children */
+  bitword	*right_nts;	/* nonterminals that are binary right children */
+  bitword	*unary_nts;	/* nonterminals with unary ancestors */
+  size_t	*uchains_start;	/* nonterminal id's chains start here ... */
+  uchain	*uchains;	/* ... and end at uchains_start[id+1] */
 } grammar;
 
+#define grammar_label_id(g, label)	\
+  ((label) < (g)->nlabels ? (g)->label_id[label] : NO_ID)
+
 si_index read_cat(FILE *fp, si_t si);
 si_index read_cat_term(FILE *fp, si_t si);
 grammar read_grammar(FILE *fp, si_t si);
+grammar read_coarse_grammar(FILE *fp, si_t si);
+si_index project_label(si_index label, si_t si);
 void write_grammar(FILE *fp, grammar g, si_t si);
 void free_grammar(grammar g);
+si_index unary_below(const grammar *g, si_index child, si_index ancestor);
+
+/* sentence_grammar() returns the rules of g that can appear in a parse
+ * of words[0..n-1], as a grammar with the same labels and ids as g
+ * that shares g's hash tables.  Free it with free_sentence_grammar(),
+ * not free_grammar().
+ */
+grammar sentence_grammar(const grammar *g, const si_index *words, size_t n);
+void free_sentence_grammar(grammar sg);
+
+/* A tag_dict lists the preterminals allowed for each terminal of a
+ * grammar: terminal id's are tags[start[id-nnts]] ..
+ * tags[start[id-nnts+1]-1].
+ */
+
+typedef struct tag_dict {
+  size_t	*start;
+  unsigned	*tags;		/* compact ids */
+} *tag_dict;
+
+tag_dict make_tag_dict(FILE *fp, const grammar *g, si_t si, double cutoff);
+void free_tag_dict(tag_dict d);
 
 #endif
 
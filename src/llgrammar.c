@@ -11,6 +11,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 
 #define MAX(x,y)	((x) < (y) ? (y) : (x))
 
@@ -137,6 +138,408 @@ push_urule(sihashurs child_urules_ht, const si_index key, const urule ur)
   ursp->e[(ursp->n)++] = ur;
 }
 
+/* number_labels() assigns compact ids to the labels of g, nonterminals
+ * first and then terminals.
+ */
+static void
+number_labels(grammar *g, si_t si)
+{
+  sihashbrsit	bhit;
+  sihashursit	uhit;
+  size_t	i, j, nterms = 0;
+  si_index	*terms;
+
+  g->nlabels = si_nstrings(si) + 1;
+  g->label_id = MALLOC(g->nlabels * sizeof(g->label_id[0]));
+  for (i = 0; i < g->nlabels; i++)
+    g->label_id[i] = NO_ID;
+
+  g->nnts = 0;
+  g->label_id[g->root_label] = g->nnts++;
+
+  for (bhit = sihashbrsit_init(g->brs); sihashbrsit_ok(bhit); bhit = sihashbrsit_next(bhit))
+    for (i = 0; i < bhit.value.n; i++)
+      if (g->label_id[bhit.value.e[i]->parent] == NO_ID)
+        g->label_id[bhit.value.e[i]->parent] = g->nnts++;
+
+  for (uhit = sihashursit_init(g->urs); sihashursit_ok(uhit); uhit = sihashursit_next(uhit))
+    for (i = 0; i < uhit.value.n; i++)
+      if (g->label_id[uhit.value.e[i]->parent] == NO_ID)
+        g->label_id[uhit.value.e[i]->parent] = g->nnts++;
+
+  /* every label that is not a parent is a terminal */
+  terms = MALLOC(g->nlabels * sizeof(terms[0]));
+
+  for (bhit = sihashbrsit_init(g->brs); sihashbrsit_ok(bhit); bhit = sihashbrsit_next(bhit))
+    for (i = 0; i < bhit.value.n; i++) {
+      si_index children[2];
+      children[0] = bhit.value.e[i]->left;
+      children[1] = bhit.value.e[i]->right;
+      for (j = 0; j < 2; j++)
+        if (g->label_id[children[j]] == NO_ID) {
+          g->label_id[children[j]] = g->nnts + nterms;
+          terms[nterms++] = children[j];
+        }}
+
+  for (uhit = sihashursit_init(g->urs); sihashursit_ok(uhit); uhit = sihashursit_next(uhit))
+    if (g->label_id[uhit.key] == NO_ID) {
+      g->label_id[uhit.key] = g->nnts + nterms;
+      terms[nterms++] = uhit.key;
+    }
+
+  g->nterms = nterms;
+  g->id_label = MALLOC((g->nnts + g->nterms) * sizeof(g->id_label[0]));
+  for (i = 1; i < g->nlabels; i++)
+    if (g->label_id[i] < g->nnts)
+      g->id_label[g->label_id[i]] = i;
+  for (i = 0; i < nterms; i++)
+    g->id_label[g->nnts + i] = terms[i];
+  FREE(terms);
+}
+
+/* pack_brules() builds the packed binary rule store from g.brs */
+
+typedef struct brule_ids {
+  unsigned	left, right, parent;
+  FLOAT		prob;
+} brule_ids;
+
+static int
+brule_ids_cmp(const void *p1, const void *p2)
+{
+  const brule_ids *r1 = p1, *r2 = p2;
+
+  if (r1->left != r2->left)
+    return r1->left < r2->left ? -1 : 1;
+  if (r1->right != r2->right)
+    return r1->right < r2->right ? -1 : 1;
+  if (r1->parent != r2->parent)
+    return r1->parent < r2->parent ? -1 : 1;
+  return 0;
+}
+
+static void index_bpairs(grammar *g);
+
+static void
+pack_brules(grammar *g)
+{
+  sihashbrsit	bhit;
+  size_t	i, n = 0, nrules = 0, nids = g->nnts + g->nterms;
+  brule_ids	*rules;
+
+  for (bhit = sihashbrsit_init(g->brs); sihashbrsit_ok(bhit); bhit = sihashbrsit_next(bhit))
+    nrules += bhit.value.n;
+
+  rules = MALLOC(nrules * sizeof(rules[0]));
+  for (bhit = sihashbrsit_init(g->brs); sihashbrsit_ok(bhit); bhit = sihashbrsit_next(bhit))
+    for (i = 0; i < bhit.value.n; i++, n++) {
+      rules[n].left = g->label_id[bhit.value.e[i]->left];
+      rules[n].right = g->label_id[bhit.value.e[i]->right];
+      rules[n].parent = g->label_id[bhit.value.e[i]->parent];
+      rules[n].prob = bhit.value.e[i]->prob;
+    }
+  qsort(rules, nrules, sizeof(rules[0]), brule_ids_cmp);
+
+  g->bleft_start = CALLOC(nids + 1, sizeof(g->bleft_start[0]));
+  g->bpairs = MALLOC((nrules + 1) * sizeof(g->bpairs[0]));
+  g->bparents = MALLOC(MAX(nrules, 1) * sizeof(g->bparents[0]));
+
+  for (n = 0, i = 0; i < nrules; i++) {
+    if (i == 0 || rules[i].left != rules[i-1].left 
+        || rules[i].right != rules[i-1].right) {
+      g->bpairs[n].right = rules[i].right;
+      g->bpairs[n].start = i;
+      g->bleft_start[rules[i].left + 1] = ++n;
+    }
+    g->bparents[i].parent = g->id_label[rules[i].parent];
+    g->bparents[i].prob = rules[i].prob;
+  }
+  g->bpairs[n].right = NO_ID;		/* sentinel */
+  g->bpairs[n].start = nrules;
+  g->nbpairs = n;
+  g->bpairs = REALLOC(g->bpairs, (n + 1) * sizeof(g->bpairs[0]));
+
+  /* left children without rules start where the previous one ended */
+  for (i = 1; i <= nids; i++)
+    g->bleft_start[i] = MAX(g->bleft_start[i], g->bleft_start[i-1]);
+  FREE(rules);
+  index_bpairs(g);
+}
+
+/* index_bpairs() indexes g's packed pairs by right child too, and
+ * records which nonterminals are left and right children.
+ */
+static void
+index_bpairs(grammar *g)
+{
+  size_t	i, k, n = g->nbpairs, nids = g->nnts + g->nterms;
+
+  /* index the pairs by right child, counting then placing */
+  g->bpair_left = MALLOC(MAX(n, 1) * sizeof(g->bpair_left[0]));
+  g->bright_start = CALLOC(nids + 1, sizeof(g->bright_start[0]));
+  g->bright_pairs = MALLOC(MAX(n, 1) * sizeof(g->bright_pairs[0]));
+  for (i = 0; i < nids; i++)
+    for (k = g->bleft_start[i]; k < g->bleft_start[i+1]; k++) {
+      g->bpair_left[k] = i;
+      g->bright_start[g->bpairs[k].right + 1]++;
+    }
+  for (i = 1; i <= nids; i++)
+    g->bright_start[i] += g->bright_start[i-1];
+  for (k = 0; k < n; k++)
+    g->bright_pairs[g->bright_start[g->bpairs[k].right]++] = k;
+  for (i = nids; i > 0; i--)		/* undo the placing increments */
+    g->bright_start[i] = g->bright_start[i-1];
+  g->bright_start[0] = 0;
+
+  g->left_nts = CALLOC(BITSET_WORDS(g->nnts), sizeof(bitword));
+  g->right_nts = CALLOC(BITSET_WORDS(g->nnts), sizeof(bitword));
+  for (i = 0; i < g->nnts; i++)
+    if (g->bleft_start[i] < g->bleft_start[i+1])
+      BITSET_SET(g->left_nts, i);
+  for (k = 0; k < n; k++)
+    if (g->bpairs[k].right < g->nnts)
+      BITSET_SET(g->right_nts, g->bpairs[k].right);
+}
+
+/* index_rules() indexes the rules of g by the ids of their children, 
+ * and records which nonterminals can be the children of which kinds
+ * of rule.
+ */
+static void
+index_rules(grammar *g)
+{
+  sihashursit	uhit;
+  size_t	nids = g->nnts + g->nterms;
+
+  pack_brules(g);
+  g->child_urs = CALLOC(nids, sizeof(g->child_urs[0]));
+
+  for (uhit = sihashursit_init(g->urs); sihashursit_ok(uhit); uhit = sihashursit_next(uhit))
+    g->child_urs[g->label_id[uhit.key]] = uhit.value;
+}
+
+/* close_unary() computes the best-scoring chain of unary rules from
+ * every nonterminal to each of its unary ancestors.  Log probs are
+ * never positive, so relaxing a worklist from each child converges.
+ * Terminals get no rows: the parser takes one unary step from a
+ * terminal and closes from the resulting preterminals, which keeps
+ * the table small for grammars with large vocabularies.
+ */
+static void
+close_unary(grammar *g)
+{
+  FLOAT		*best = MALLOC(g->nnts * sizeof(FLOAT));
+  unsigned	*below = MALLOC(g->nnts * sizeof(unsigned));
+  unsigned	*queue = MALLOC((g->nnts + 1) * sizeof(unsigned));
+  char		*queued = CALLOC(g->nnts, sizeof(char));
+  unsigned	*touched = MALLOC(g->nnts * sizeof(unsigned));
+  size_t	child, i, head, tail, ntouched, n = 0, nsize = g->nnts;
+
+  g->unary_nts = CALLOC(BITSET_WORDS(g->nnts), sizeof(bitword));
+  g->uchains_start = MALLOC((g->nnts + 1) * sizeof(size_t));
+  g->uchains = MALLOC(nsize * sizeof(uchain));
+
+  for (i = 0; i < g->nnts; i++)
+    best[i] = -HUGE_VAL;
+
+  for (child = 0; child < g->nnts; child++) {
+    g->uchains_start[child] = n;
+    if (g->child_urs[child].n == 0)
+      continue;
+
+    /* queue is a ring buffer; a node is on it at most once at a time */
+    best[child] = 0;
+    queue[0] = child;
+    queued[child] = 1;
+    head = 0;
+    tail = 1;
+    touched[0] = child;
+    ntouched = 1;
+
+    while (head != tail) {
+      unsigned x = queue[head];
+      urules   urs = g->child_urs[x];
+
+      head = (head + 1) % (g->nnts + 1);
+      queued[x] = 0;
+      for (i = 0; i < urs.n; i++) {
+        unsigned p = g->label_id[urs.e[i]->parent];
+        FLOAT	 prob = best[x] + urs.e[i]->prob;
+
+        if (p == child || prob <= best[p])
+          continue;
+        if (best[p] == -HUGE_VAL)
+          touched[ntouched++] = p;
+        best[p] = prob;
+        below[p] = x;
+        if (!queued[p]) {
+          queue[tail] = p;
+          tail = (tail + 1) % (g->nnts + 1);
+          queued[p] = 1;
+        }}}
+
+    for (i = 0; i < ntouched; i++) {
+      unsigned p = touched[i];
+
+      if (p != child) {
+        if (n >= nsize) {
+          nsize *= 2;
+          g->uchains = REALLOC(g->uchains, nsize * sizeof(uchain));
+        }
+        g->uchains[n].parent = p;
+        g->uchains[n].below = below[p];
+        g->uchains[n].prob = best[p];
+        n++;
+      }
+      best[p] = -HUGE_VAL;
+    }
+    if (n > g->uchains_start[child])
+      BITSET_SET(g->unary_nts, child);
+  }
+  g->uchains_start[g->nnts] = n;
+
+  FREE(best);
+  FREE(below);
+  FREE(queue);
+  FREE(queued);
+  FREE(touched);
+}
+
+/* unary_below() returns the label immediately below ancestor on the
+ * best unary chain from child, which is child itself if the chain is a
+ * single rule (as it always is when child is a terminal).
+ */
+si_index
+unary_below(const grammar *g, si_index child, si_index ancestor)
+{
+  unsigned c = grammar_label_id(g, child), a = grammar_label_id(g, ancestor);
+  size_t   i;
+
+  if (c >= g->nnts)
+    return child;
+
+  for (i = g->uchains_start[c]; i < g->uchains_start[c+1]; i++)
+    if (g->uchains[i].parent == a)
+      return g->id_label[g->uchains[i].below];
+
+  assert(0);	/* ancestor is not a unary ancestor of child */
+  return child;
+}
+
+/* sentence_grammar() returns the part of g that can be used in a
+ * parse of words[0..n-1]: the nonterminals that can be built from
+ * them bottom-up, found with a worklist, and the binary rules and
+ * unary chains over those.  The result shares g's labels, hash tables
+ * and lexical rules, and has its own packed binary rules and unary
+ * chains, in the same order as g's.
+ */
+grammar
+sentence_grammar(const grammar *g, const si_index *words, size_t n)
+{
+  grammar	sg = *g;
+  size_t	nids = g->nnts + g->nterms, nnts = g->nnts;
+  size_t	i, k, x, head = 0, tail = 0, npairs = 0, nrules = 0, nchains = 0;
+  bitword	*reached = CALLOC(BITSET_WORDS(nids), sizeof(bitword));
+  unsigned	*queue = MALLOC((nnts + n + 1) * sizeof(unsigned)), id;
+
+#define REACH(id)					\
+  do { if (!BITSET_TEST(reached, id)) {			\
+      BITSET_SET(reached, id);				\
+      queue[tail++] = id; }} while (0)
+
+  for (i = 0; i < n; i++)
+    if ((id = grammar_label_id(g, words[i])) != NO_ID)
+      REACH(id);
+
+  while (head < tail) {
+    id = queue[head++];
+    if (id < nnts)
+      for (x = g->uchains_start[id]; x < g->uchains_start[id+1]; x++)
+        REACH(g->uchains[x].parent);
+    else
+      for (x = 0; x < g->child_urs[id].n; x++)
+        REACH(g->label_id[g->child_urs[id].e[x]->parent]);
+    for (k = g->bleft_start[id]; k < g->bleft_start[id+1]; k++)
+      if (BITSET_TEST(reached, g->bpairs[k].right))
+        for (x = g->bpairs[k].start; x < g->bpairs[k+1].start; x++)
+          REACH(g->label_id[g->bparents[x].parent]);
+    for (i = g->bright_start[id]; i < g->bright_start[id+1]; i++) {
+      k = g->bright_pairs[i];
+      if (g->bpair_left[k] != id && BITSET_TEST(reached, g->bpair_left[k]))
+        for (x = g->bpairs[k].start; x < g->bpairs[k+1].start; x++)
+          REACH(g->label_id[g->bparents[x].parent]);
+    }}
+#undef REACH
+
+  /* the binary rules whose children were both reached */
+
+  for (id = bitset_next(reached, 0, nids); id < nids; 
+       id = bitset_next(reached, id+1, nids))
+    for (k = g->bleft_start[id]; k < g->bleft_start[id+1]; k++)
+      if (BITSET_TEST(reached, g->bpairs[k].right)) {
+        npairs++;
+        nrules += g->bpairs[k+1].start - g->bpairs[k].start;
+      }
+  sg.bleft_start = CALLOC(nids + 1, sizeof(sg.bleft_start[0]));
+  sg.bpairs = MALLOC((npairs + 1) * sizeof(sg.bpairs[0]));
+  sg.bparents = MALLOC(MAX(nrules, 1) * sizeof(sg.bparents[0]));
+  npairs = nrules = 0;
+  for (id = bitset_next(reached, 0, nids); id < nids; 
+       id = bitset_next(reached, id+1, nids)) {
+    for (k = g->bleft_start[id]; k < g->bleft_start[id+1]; k++)
+      if (BITSET_TEST(reached, g->bpairs[k].right)) {
+        sg.bpairs[npairs].right = g->bpairs[k].right;
+        sg.bpairs[npairs++].start = nrules;
+        for (x = g->bpairs[k].start; x < g->bpairs[k+1].start; x++)
+          sg.bparents[nrules++] = g->bparents[x];
+      }
+    sg.bleft_start[id + 1] = npairs;
+  }
+  sg.bpairs[npairs].right = NO_ID;	/* sentinel */
+  sg.bpairs[npairs].start = nrules;
+  sg.nbpairs = npairs;
+  for (i = 1; i <= nids; i++)
+    sg.bleft_start[i] = MAX(sg.bleft_start[i], sg.bleft_start[i-1]);
+  index_bpairs(&sg);
+
+  /* the unary chains from the nonterminals that were reached */
+
+  for (id = bitset_next(reached, 0, nnts); id < nnts; 
+       id = bitset_next(reached, id+1, nnts))
+    nchains += g->uchains_start[id+1] - g->uchains_start[id];
+  sg.unary_nts = CALLOC(BITSET_WORDS(nnts), sizeof(bitword));
+  sg.uchains_start = MALLOC((nnts + 1) * sizeof(size_t));
+  sg.uchains = MALLOC(MAX(nchains, 1) * sizeof(uchain));
+  for (nchains = 0, id = 0; id < nnts; id++) {
+    sg.uchains_start[id] = nchains;
+    if (BITSET_TEST(reached, id) && BITSET_TEST(g->unary_nts, id)) {
+      for (x = g->uchains_start[id]; x < g->uchains_start[id+1]; x++)
+        sg.uchains[nchains++] = g->uchains[x];
+      BITSET_SET(sg.unary_nts, id);
+    }}
+  sg.uchains_start[nnts] = nchains;
+
+  FREE(reached);
+  FREE(queue);
+  return sg;
+}
+
+void
+free_sentence_grammar(grammar sg)
+{
+  FREE(sg.bleft_start);
+  FREE(sg.bpairs);
+  FREE(sg.bparents);
+  FREE(sg.bpair_left);
+  FREE(sg.bright_start);
+  FREE(sg.bright_pairs);
+  FREE(sg.left_nts);
+  FREE(sg.right_nts);
+  FREE(sg.unary_nts);
+  FREE(sg.uchains_start);
+  FREE(sg.uchains);
+}
+
 si_index 
 read_cat(FILE *fp, si_t si)
 {
@@ -199,13 +602,88 @@ read_cat_term(FILE *fp, si_t si)
 }
   
   
+/* project_label() strips the parent annotation (everything from
+ * PARENTSEP on) from each of the BINSEP-separated categories in label,
+ * as remove_parent_annotation() does for trees.  Terminals are left
+ * alone.
+ */
+si_index
+project_label(si_index label, si_t si)
+{
+  char	 s[MAXBLABELLEN];
+  char	 *p = si_index_string(si, label), *cat, *end;
+  size_t i = 0, n;
+
+  if (!strchr(p, PARENTSEP))
+    return label;
+
+  for (cat = p; *cat; cat = *end ? end+1 : end) {
+    if (!(end = strchr(cat, BINSEP)))
+      end = cat + strlen(cat);
+    n = end - cat;
+    if (!(n >= 2 && cat[0] == '_' && cat[n-1] == '_')) {
+      char *sep = memchr(cat, PARENTSEP, n);
+      if (sep)
+        n = sep - cat;
+    }
+    assert(i + n + 1 < MAXBLABELLEN);
+    if (i > 0)
+      s[i++] = BINSEP;
+    memcpy(s + i, cat, n);
+    i += n;
+  }
+  s[i] = '\0';
+  return si_string_index(si, s);
+}
+
+/* add_urule() is like push_urule(), but adds weight to an existing
+ * rule with the same parent and child instead of making a new one.
+ */
+static void
+add_urule(sihashurs child_urules_ht, const FLOAT weight, 
+          const si_index parent, const si_index child)
+{
+  urules *ursp = sihashurs_valuep(child_urules_ht, child);
+  size_t i;
+
+  for (i = 0; i < ursp->n; i++)
+    if (ursp->e[i]->parent == parent) {
+      ursp->e[i]->prob += weight;
+      return;
+    }
+  push_urule(child_urules_ht, child, make_urule(weight, parent, child));
+}
+
+static grammar read_grammar_(FILE *fp, si_t si, int coarse);
+
+grammar
+read_grammar(FILE *fp, si_t si)
+{
+  return read_grammar_(fp, si, 0);
+}
+
+/* read_coarse_grammar() reads the grammar in fp with every category
+ * projected by project_label().  A coarse rule's weight is the sum of
+ * the weights of the rules that project onto it.  Unary rules that
+ * project onto X --> X count toward X's total weight, but are not kept
+ * as rules: X's other rules are scaled by 1/(1 - s), where s is the
+ * probability of X --> X, which is the sum over the chains of X --> X
+ * rules that could precede them.
+ */
 grammar
-read_grammar(FILE *fp, si_t si) 
+read_coarse_grammar(FILE *fp, si_t si)
+{
+  return read_grammar_(fp, si, 1);
+}
+
+static grammar
+read_grammar_(FILE *fp, si_t si, int coarse) 
 {
   sihashbrs left_brules_ht = make_sihashbrs(NLABELS);
   sihashurs child_urules_ht = make_sihashurs(NLABELS);
   sihashurs parent_child_urules_ht = make_sihashurs(5); /* underestimate, to ensure dense packing */
   sihashf  parent_weight_ht = make_sihashf(NLABELS);
+  sihashf  self_weight_ht = make_sihashf(coarse ? NLABELS : 1); /* X --> X */
   brihashbr brihtbr = make_brihashbr(NLABELS);
   int n;
   double weight;
@@ -221,6 +699,8 @@ read_grammar(FILE *fp, si_t si)
     lhs = read_cat(fp, si);
     assert(weight > 0);
     assert(lhs);
+    if (coarse)
+      lhs = project_label(lhs, si);
     if (!root_label)
       root_label = lhs;
 
@@ -230,7 +710,7 @@ read_grammar(FILE *fp, si_t si)
       cat = read_cat(fp, si);
       if (!cat)
         break;
-      rhs[n] = cat;
+      rhs[n] = coarse ? project_label(cat, si) : cat;
     }
 
     if (n >= MAXRHS) {
@@ -244,6 +724,14 @@ read_grammar(FILE *fp, si_t si)
       exit(EXIT_FAILURE);
       break;
     case 1: 
+      if (coarse) {
+        if (rhs[0] != lhs)
+          add_urule(child_urules_ht, weight, lhs, rhs[0]);
+        else
+          sihashf_inc(self_weight_ht, lhs, weight);
+        sihashf_inc(parent_weight_ht, lhs, weight);
+        break;
+      }
       ur = make_urule(weight, lhs, rhs[0]);
       push_urule(child_urules_ht, ur->child, ur);
       sihashf_inc(parent_weight_ht, ur->parent, weight);
@@ -292,18 +780,26 @@ read_grammar(FILE *fp, si_t si)
   { 
     int i; /* normalize grammar rules, take logs of rule probabilities */
 
+    /* rule_lprob(parent, weight) is the log probability of a rule,
+     * weight/W, times parent's X --> X chain factor 1/(1 - S/W), where W
+     * is parent's total weight and S that of its X --> X rules */
+#define rule_lprob(parent, weight)					\
+    log((weight)/(sihashf_ref(parent_weight_ht, parent)		\
+                  - sihashf_ref(self_weight_ht, parent)))
+
     for (bhit = sihashbrsit_init(left_brules_ht); sihashbrsit_ok(bhit); bhit = sihashbrsit_next(bhit)) {
       for (i=0; i<bhit.value.n; i++) {
-        bhit.value.e[i]->prob = log(bhit.value.e[i]->prob/sihashf_ref(parent_weight_ht, bhit.value.e[i]->parent));
+        bhit.value.e[i]->prob = rule_lprob(bhit.value.e[i]->parent, bhit.value.e[i]->prob);
         assert(bhit.value.e[i]->prob <= 0);
       }
     }
 
     for (uhit = sihashursit_init(child_urules_ht); sihashursit_ok(uhit); uhit = sihashursit_next(uhit))
       for (i=0; i<uhit.value.n; i++) {
-        uhit.value.e[i]->prob = log(uhit.value.e[i]->prob/sihashf_ref(parent_weight_ht, uhit.value.e[i]->parent));
+        uhit.value.e[i]->prob = rule_lprob(uhit.value.e[i]->parent, uhit.value.e[i]->prob);
         assert(uhit.value.e[i]->prob <= 0);
       }
+#undef rule_lprob
   }
 
   {
@@ -328,6 +824,7 @@ read_grammar(FILE *fp, si_t si)
             }}}}}
   
   free_sihashf(parent_weight_ht);
+  free_sihashf(self_weight_ht);
  
   {
     grammar g;
@@ -335,6 +832,9 @@ read_grammar(FILE *fp, si_t si)
     g.parent_urs = parent_child_urules_ht;
     g.brs = left_brules_ht;
     g.root_label = root_label;
+    number_labels(&g, si);
+    index_rules(&g);
+    close_unary(&g);
     return g;
   }
 }
@@ -366,5 +866,92 @@ free_grammar(grammar g)
   free_sihashurs(g.urs);
   free_sihashurs(g.parent_urs);
   free_sihashbrs(g.brs);
+  FREE(g.label_id);
+  FREE(g.id_label);
+  FREE(g.bleft_start);
+  FREE(g.bpairs);
+  FREE(g.bparents);
+  FREE(g.bpair_left);
+  FREE(g.bright_start);
+  FREE(g.bright_pairs);
+  FREE(g.child_urs);
+  FREE(g.left_nts);
+  FREE(g.right_nts);
+  FREE(g.unary_nts);
+  FREE(g.uchains_start);
+  FREE(g.uchains);
+}
+
+
+/* tag_slot() returns the index in urs of the first rule with parent,
+ * which stands for all of parent's rules in urs (read_grammar() keeps
+ * duplicated lexical rules separately), or urs.n if there is none.
+ */
+static size_t
+tag_slot(urules urs, si_index parent)
+{
+  size_t k;
+
+  for (k = 0; k < urs.n && urs.e[k]->parent != parent; k++)
+    ;
+  return k;
+}
+
+/* make_tag_dict() reads the grammar in fp again for the weights of its
+ * lexical rules, and allows each word the preterminals whose rules
+ * rewriting it have at least weight cutoff in all (all of them if
+ * none do).  The weights of duplicated rules are summed per word and
+ * tag before they are compared with cutoff.
+ */
+tag_dict
+make_tag_dict(FILE *fp, const grammar *g, si_t si, double cutoff)
+{
+  tag_dict	d = MALLOC(sizeof(struct tag_dict));
+  size_t	nterms = g->nterms, t, k, n;
+  double	weight, *w;
+  si_index	lhs, cat, rhs[MAXRHS];
+
+  d->start = MALLOC((nterms + 1) * sizeof(size_t));
+  d->start[0] = 0;
+  for (t = 0; t < nterms; t++)
+    d->start[t+1] = d->start[t] + g->child_urs[g->nnts + t].n;
+  w = CALLOC(d->start[nterms] + 1, sizeof(double));
+
+  rewind(fp);
+  while (fscanf(fp, " %lg ", &weight) == 1) {
+    lhs = read_cat(fp, si);
+    fscanf(fp, " " REWRITES);
+    for (n = 0; n < MAXRHS && (cat = read_cat(fp, si)); n++)
+      rhs[n] = cat;
+    if (n == 1 && (t = grammar_label_id(g, rhs[0])) != NO_ID && t >= g->nnts
+        && (k = tag_slot(g->child_urs[t], lhs)) < g->child_urs[t].n)
+      w[d->start[t - g->nnts] + k] += weight;
+  }
+
+  d->tags = MALLOC((d->start[nterms] + 1) * sizeof(unsigned));
+  for (n = 0, t = 0; t < nterms; t++) {
+    urules urs = g->child_urs[g->nnts + t];
+    size_t first = n;
+
+    /* each tag once, at its slot, with its duplicates' weight */
+    for (k = 0; k < urs.n; k++)
+      if (tag_slot(urs, urs.e[k]->parent) == k && w[d->start[t] + k] >= cutoff)
+        d->tags[n++] = g->label_id[urs.e[k]->parent];
+    if (n == first)			/* none are frequent enough */
+      for (k = 0; k < urs.n; k++)
+        if (tag_slot(urs, urs.e[k]->parent) == k)
+          d->tags[n++] = g->label_id[urs.e[k]->parent];
+    d->start[t] = first;
+  }
+  d->start[nterms] = n;
+  FREE(w);
+  return d;
 }
 
+void
+free_tag_dict(tag_dict d)
+{
+  FREE(d->start);
+  FREE(d->tags);
+  FREE(d);
+}
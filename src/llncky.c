@@ -18,6 +18,13 @@
 #include "hash.h"
 #include "hash-templates.h"
 #include "blockalloc.h"
+#include "bitset.h"
+#include "coarse.h"
+#include "inout.h"
+#include "semiring.h"
+#include "prefix.h"
+#include "recognize.h"
+#include "deadline.h"
 
 #include <ctype.h>
 #include <stdio.h>
@@ -26,11 +33,35 @@
 #include <math.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
+#ifndef RAND_SEED
 #define RAND_SEED	time(0)
+#endif
+
+/* Ties between edges with the same log prob are broken by a hash of
+ * each edge (see edge_key()) seeded from rand_seed and the sentence
+ * number: a cell keeps the tied edge with the smallest key.  Each
+ * tied edge is as likely to win as any other, and the winner doesn't
+ * depend on the order the edges are found in, so the parses don't
+ * depend on which thread (-j) parses a sentence or on how its spans
+ * are divided among threads (-J).
+ */
+unsigned		rand_seed;
+__thread int		sentenceno = 0;
+
+__thread double	deadline = 0;		/* see deadline.h */
+__thread int	timed_out = 0;
 
 #define CHART_SIZE(n)			(n)*((n)+1)/2
-#define CHART_ENTRY(chart, i, j)	chart->cell[(j)*((j)-1)/2+(i)]
+#define CHART_INDEX(chart, i, j)	\
+  ((chart)->w ? (i)*(chart)->w + (j)-(i)-1 : (j)*((j)-1)/2+(i))
+#define CHART_ENTRY(chart, i, j)	chart->cell[CHART_INDEX(chart, i, j)]
+#define CHART_IN_BAND(chart, i, j)	(!(chart)->w || (j)-(i) <= (chart)->w)
 
 #define MALLOC_CHART(n)			blockalloc_malloc(n)
 #define FREE_CHART			blockalloc_free_all()
@@ -38,7 +69,6 @@
 typedef struct chart_cell {
   struct bintree tree;
   FLOAT		 lprob;
-  unsigned int   nalt;
   int		 rightpos;
   struct chart_cell *next;
 } *chart_cell;
@@ -53,7 +83,6 @@ make_chart_cell(si_index label, bintree left, bintree right,
   c->tree.left = left;
   c->tree.right = right;
   c->lprob = lprob;
-  c->nalt = 1;
   c->rightpos = rightpos;
   c->next = next;
   return c;
@@ -72,31 +101,207 @@ make_chart_cell(si_index label, bintree left, bintree right,
 #include "ncky-helper.c"	
 
 
+/* A chart entry maps labels to chart cells.  There is an entry for
+ * every span, and one for every string position (the vertex entries,
+ * which map a label to the list of cells starting at that position).
+ *
+ * Hash entries (the default) are sihashcc tables keyed by si_index.
+ * Dense entries (-c dense) are arrays indexed by the grammar's compact
+ * nonterminal ids; the only terminal that can appear in an entry is
+ * the word at that position, which is kept separately in term.
+ */
+
+typedef struct centry {
+  sihashcc	ht;		/* hash entry, or NULL if dense */
+  chart_cell	*cell;		/* cell[id] for nonterminal id, or NULL */
+  FLOAT		*lprob;		/* lprob[id] == cell[id]->lprob (spans only) */
+  bitword	*present;	/* bit id set iff nonterminal id is present */
+  chart_cell	term;		/* terminal cell, if any */
+  size_t	n;		/* number of labels in this entry */
+  const bitword	*allowed;	/* allowed label ids, or NULL if all are */
+  FLOAT		*pre_lprob;	/* best binary or lexical lprob of each id */
+} *centry;
+
+int	dense_chart = 0;	/* build dense chart entries */
+int	kbest = 0;		/* number of parses per sentence (-N), or 0 */
+
+#define PRE_NONE	(-1e30)	/* pre_lprob of an id with no such edge */
+__thread int cells_probed = 0;	/* number of label lookups that reached ht/cell */
+
+static centry
+make_centry(const grammar *g, size_t hashsize, int span)
+{
+  centry e = MALLOC_CHART(sizeof(struct centry));
+
+  e->term = NULL;
+  e->n = 0;
+  e->allowed = NULL;
+  e->pre_lprob = NULL;
+  e->present = MALLOC_CHART(BITSET_BYTES(g->nnts));
+  memset(e->present, 0, BITSET_BYTES(g->nnts));
+
+  if (!dense_chart) {
+    e->ht = make_sihashcc(hashsize);
+    e->cell = NULL;
+    e->lprob = NULL;
+  }
+  else {
+    e->ht = NULL;
+    e->cell = MALLOC_CHART(g->nnts*sizeof(chart_cell));
+    memset(e->cell, 0, g->nnts*sizeof(chart_cell));
+    e->lprob = span ? MALLOC_CHART(g->nnts*sizeof(FLOAT)) : NULL;
+  }
+
+  /* k-best extraction needs the best edge below each unary chain */
+  if (kbest && span) {
+    size_t id;
+
+    e->pre_lprob = MALLOC_CHART(g->nnts*sizeof(FLOAT));
+    for (id = 0; id < g->nnts; id++)
+      e->pre_lprob[id] = PRE_NONE;
+  }
+  return e;
+}
+
+/* centry_ref() consults the presence bitset first, so lookups of
+ * absent nonterminals never touch the hash table.
+ */
+static chart_cell
+centry_ref(const centry e, si_index label, const grammar *g)
+{
+  unsigned id = grammar_label_id(g, label);
+
+  if (id < g->nnts) {
+    if (!BITSET_TEST(e->present, id))
+      return NULL;
+    cells_probed++;
+    return e->ht ? sihashcc_ref(e->ht, label) : e->cell[id];
+  }
+
+  cells_probed++;
+  if (e->ht)
+    return sihashcc_ref(e->ht, label);
+  return (e->term && e->term->tree.label == label) ? e->term : NULL;
+}
+
+/* centry_id_ref() returns the cell for nonterminal id, which must be 
+ * present in e.
+ */
+static chart_cell
+centry_id_ref(const centry e, unsigned id, const grammar *g)
+{
+  assert(id < g->nnts && BITSET_TEST(e->present, id));
+  return e->ht ? sihashcc_ref(e->ht, g->id_label[id]) : e->cell[id];
+}
+
+/* centry_id_find() returns the cell in e for id, which may be a
+ * nonterminal or a terminal id, or NULL if there is none.
+ */
+static chart_cell
+centry_id_find(const centry e, unsigned id, const grammar *g)
+{
+  if (id < g->nnts) {
+    if (!BITSET_TEST(e->present, id))
+      return NULL;
+    cells_probed++;
+    return e->ht ? sihashcc_ref(e->ht, g->id_label[id]) : e->cell[id];
+  }
+  if (e->ht)
+    return sihashcc_ref(e->ht, g->id_label[id]);
+  return (e->term && e->term->tree.label == g->id_label[id]) ? e->term : NULL;
+}
+
+static chart_cell *
+centry_valuep(centry e, si_index label, unsigned id, const grammar *g)
+{
+  if (e->ht)
+    return sihashcc_valuep(e->ht, label);
+  if (id < g->nnts)
+    return &e->cell[id];
+  assert(!e->term || e->term->tree.label == label);
+  return &e->term;
+}
+
+
+/* Chart entries are only made when the first edge lands in them, so
+ * an empty span costs a NULL pointer and nothing else.  spans is a
+ * bit-matrix with bit (left, right) set iff that span's entry exists,
+ * which lets cky() step over the empty spans of each row.
+ *
+ * With a maximum span width (-W width) a sentence longer than width
+ * gets a banded chart, which only has entries for spans of up to w
+ * words: entry (i, j) is cell[i*w + j-i-1], and bit j-i of row i of
+ * spans is set iff it exists.  So the chart takes O(n w) space, and
+ * CKY O(n w^2) time.
+ */
+
 typedef struct chart {
-  sihashcc *cell;
-  sihashcc *vertex;
+  size_t  n;
+  size_t  w;		/* the band's width, or 0 if the chart is full */
+  centry  *cell;	/* CHART_ENTRY(c, i, j), or NULL if empty */
+  centry  *vertex;	/* vertex[i], or NULL if no cell starts at i */
+  bitword *spans;	/* row i has bit j set iff span i..j exists */
+  coarse_mask mask;	/* allowed labels from the prepasses, or NULL */
 } *chart;
 
+#define CHART_NENTRIES(c)	((c)->w ? (c)->n*(c)->w : CHART_SIZE((c)->n))
+#define SPAN_WORDS(c)		BITSET_WORDS((c)->w ? (c)->w+1 : (c)->n+1)
+#define SPAN_ROW(c, i)		((c)->spans + (i)*SPAN_WORDS(c))
+#define SPAN_BIT(c, i, j)	((c)->w ? (j)-(i) : (j))
+
+int	max_span_width = 0;	/* -W width, or 0 for no limit */
+
+/* exhaustive is set while -x reparses a sentence without pruning or
+ * bands
+ */
+__thread int exhaustive = 0;
 
 chart
-chart_make(size_t n)
+chart_make(size_t n, coarse_mask mask)
 {
-  size_t  i, left, right, nn = CHART_SIZE(n);
   chart   c = MALLOC(sizeof(struct chart));
   
-  c->vertex = MALLOC((n+1)*sizeof(sihashcc));
+  c->n = n;
+  c->w = !exhaustive && max_span_width > 0 && (size_t) max_span_width < n ?
+    max_span_width : 0;
+  c->mask = mask;
+  c->vertex = CALLOC(n+1, sizeof(centry));
+  c->cell = CALLOC(CHART_NENTRIES(c), sizeof(centry));
+  c->spans = CALLOC(n+1, SPAN_WORDS(c) * sizeof(bitword));
+  return c;
+}
 
-  for (i = 0; i <= n; i++)
-    c->vertex[i] = make_sihashcc(CHART_CELLS);
+/* span_next() returns the first right end from right on of an entry
+ * starting at left, or c->n if there is none before c->n.
+ */
+static inline int
+span_next(chart c, int left, int right)
+{
+  size_t base = c->w ? left : 0;
+  size_t end = c->w && left + c->w < c->n ? left + c->w + 1 : c->n;
+  size_t j = bitset_next(SPAN_ROW(c, left), right - base, end - base) + base;
 
-  c->cell = MALLOC(nn*sizeof(sihashcc));
-  
-  for (left = 0; left < n; left++)
-    for (right = left+1; right <= n; right++) 
-      CHART_ENTRY(c, left, right) = 
-        make_sihashcc(left+1 == right ? NLABELS : CHART_CELLS);
+  return j < end ? j : c->n;
+}
 
-  return c;
+/* chart_span() returns the entry for left..right, making it (and the
+ * vertex entry for left) if this is the first edge to land there.
+ * Span hash tables start small and grow as labels are added.
+ */
+static centry
+chart_span(chart c, int left, int right, const grammar *g)
+{
+  centry *ep = &CHART_ENTRY(c, left, right);
+
+  if (!*ep) {
+    *ep = make_centry(g, NLABELS, 1);
+    if (c->mask)
+      (*ep)->allowed = COARSE_ALLOWED(c->mask, left, right);
+    BITSET_SET(SPAN_ROW(c, left), SPAN_BIT(c, left, right));
+    if (!c->vertex[left])
+      c->vertex[left] = make_centry(g, CHART_CELLS, 0);
+  }
+  return *ep;
 }
 
 
@@ -105,19 +310,18 @@ chart_free(chart c, size_t n)
 {
   size_t i;
 
-  /* vertex cell values will be freed below */
-  for (i=0; i<=n; i++) {
-    FREE(c->vertex[i]->table);
-    FREE(c->vertex[i]);
-  }
+  /* cells and dense entries are freed by FREE_CHART */
+  for (i=0; i<=n; i++)
+    if (c->vertex[i] && c->vertex[i]->ht)
+      free_sihashcc(c->vertex[i]->ht);
 
-  for (i = 0; i < CHART_SIZE(n); i++) {
-    assert(c->cell[i]);
-    free_sihashcc(c->cell[i]);
-  }
+  for (i = 0; i < CHART_NENTRIES(c); i++)
+    if (c->cell[i] && c->cell[i]->ht)
+      free_sihashcc(c->cell[i]->ht);
   
   FREE(c->vertex);
   FREE(c->cell);
+  FREE(c->spans);
   FREE(c);
   FREE_CHART;
 }
@@ -143,21 +347,280 @@ chart_entry_display(FILE *fp, sihashcc chart_entry, si_t si)
 */
 
 int           verbose = 0;
-int           edges_proposed = 0;
-  
+__thread int  edges_proposed = 0;
+
+/* Coarse-to-fine parsing (-C threshold) only builds cells whose label
+ * projects onto a coarse label allowed in their span by the coarse
+ * parse (see coarse.h).
+ */
+coarse	      coarse_grammar = NULL;
+double	      coarse_threshold = 0;
+int	      coarse_fallbacks = 0;
+
+/* The recognition prepass (-R) only builds cells that are part of
+ * some parse (see recognize.h), and sentences without one aren't
+ * parsed at all.
+ */
+int	      recognize_first = 0;
+recognizer    prepass = NULL;
+int	      prepass_failures = 0;
+
+/* With -r each sentence is parsed with only the rules that can be
+ * built bottom-up from its words (see sentence_grammar()).
+ */
+int	      restrict_grammar = 0;
+
+/* Span constraints (-B file) come from a file with a line for each
+ * sentence of the yield file, listing "+i:j" for a span that must be a
+ * constituent and "-i:j" for one that can't be, where positions count
+ * the words before them.  A span is allowed unless it is forbidden or
+ * crosses a required span; since the chart is binary, the best parse
+ * then has a node over every required span.  Spans of one word are
+ * always allowed.  When a sentence with constraints has no parse, an
+ * unconstrained recognizer pass says whether the constraints are to
+ * blame.
+ */
+FILE	     *constraintfp = NULL;
+char	     *constraint_line = NULL;	/* the current sentence's line */
+size_t	      constraint_linesize = 0;
+recognizer    constraint_check = NULL;
+int	      constraint_failures = 0;
+
+/* read_line() reads the next sentence's line of fp into *line,
+ * leaving it empty when the file has run out.
+ */
+static void
+read_line(FILE *fp, char **line, size_t *size)
+{
+  if (getline(line, size, fp) < 0 && *line)
+    (*line)[0] = '\0';
+}
+
+/* Tag pruning only puts a word's allowed preterminals in its cell.
+ * They come from a tag dictionary (-D cutoff; see make_tag_dict()),
+ * or a tagger file (-T file) with a line for each sentence of the
+ * yield file and a field for each word, which is its tags separated
+ * by '|', or '*' for any tag; with both, a word gets the tags both
+ * allow.  A word that would be left with none of its preterminals
+ * keeps them all.  tag_sets holds each word's allowed preterminals
+ * while a sentence is parsed, and is NULL when there is no pruning.
+ */
+double	      tag_cutoff = 0;
+tag_dict      tag_dictionary = NULL;
+FILE	     *tagfp = NULL;
+char	     *tag_line = NULL;		/* the current sentence's tags */
+size_t	      tag_linesize = 0;
+__thread bitword *tag_sets = NULL;
+size_t	      tag_words;		/* bitwords per word of tag_sets */
+
+#define TAG_ALLOWED(i, label, g)	\
+  (!tag_sets || BITSET_TEST(tag_sets + (i)*tag_words, (g)->label_id[label]))
+
+/* make_tag_sets() returns the allowed preterminals of each of terms,
+ * a row of tag_words bitwords per word.
+ */
+static bitword *
+make_tag_sets(const struct vindex *terms, const grammar *g, si_t si, int sentenceno)
+{
+  size_t	n = terms->n, i, k;
+  bitword	*sets = CALLOC((n+1) * tag_words, sizeof(bitword));
+  char		*p = tag_line, *end;
+
+  if (tagfp) {		/* check there is a field for every word */
+    for (i = 0; p && *(p += strspn(p, " \t\n")); i++)
+      p += strcspn(p, " \t\n");
+    if (i != n) {
+      if (i > 0)
+        fprintf(stderr, "Sentence %d: ignoring %lu tags for %lu words\n",
+                sentenceno, (unsigned long) i, (unsigned long) n);
+      p = NULL;
+    }
+    else
+      p = tag_line;
+  }
+
+  for (i = 0; i < n; i++) {
+    bitword  *set = sets + i*tag_words;
+    unsigned id = grammar_label_id(g, terms->e[i]);
+    urules   urs = id == NO_ID ? (urules) {NULL, 0, 0} : g->child_urs[id];
+
+    if (p) {
+      p += strspn(p, " \t\n");
+      end = p + strcspn(p, " \t\n");
+      if (*p == '*' && end == p+1)
+        memset(set, 0xff, tag_words * sizeof(bitword));
+      else
+        while (p < end) {
+          size_t   len = strcspn(p, "|");
+          char     c, *tag = p;
+          unsigned t;
+
+          if (p + len > end)
+            len = end - p;
+          p += len;
+          c = *p;
+          *p = '\0';
+          if ((t = grammar_label_id(g, si_string_index(si, tag))) < g->nnts)
+            BITSET_SET(set, t);
+          *p = c;
+          if (p < end)
+            p++;		/* skip the '|' */
+        }
+      p = end;
+    }
+    else
+      memset(set, 0xff, tag_words * sizeof(bitword));
+
+    if (tag_dictionary && id != NO_ID) {
+      bitword *dict = sets + n*tag_words;	/* scratch row */
+      size_t   x;
+
+      memset(dict, 0, tag_words * sizeof(bitword));
+      for (x = tag_dictionary->start[id - g->nnts]; 
+           x < tag_dictionary->start[id - g->nnts + 1]; x++)
+        BITSET_SET(dict, tag_dictionary->tags[x]);
+      for (x = 0; x < tag_words; x++)
+        set[x] &= dict[x];
+    }
+
+    for (k = 0; k < urs.n; k++)
+      if (BITSET_TEST(set, g->label_id[urs.e[k]->parent]))
+        break;
+    if (k == urs.n)		/* none of the word's tags are allowed */
+      memset(set, 0xff, tag_words * sizeof(bitword));
+  }
+  return sets;
+}
+
+/* i..j crosses l..r if they overlap and neither contains the other */
+
+#define CROSSES(i, j, l, r)	\
+  (((i) < (l) && (l) < (j) && (j) < (r)) || ((l) < (i) && (i) < (r) && (r) < (j)))
+
+/* constraint_mask() returns the mask of the constraints in the current
+ * line for a sentence of n words, or NULL if there are none.
+ */
+static coarse_mask
+constraint_mask(size_t n, const grammar *g, int sentenceno)
+{
+  const char	*p = constraint_line;
+  size_t	nspans = n*(n+1)/2, nc = 0, i, j, k;
+  int		*c = NULL;	/* sign, left and right of each constraint */
+  coarse_mask	m;
+  char		sign;
+  int		left, right, len;
+
+  while (p && sscanf(p, " %c%d:%d%n", &sign, &left, &right, &len) == 3) {
+    p += len;
+    if ((sign != '+' && sign != '-') 
+        || left < 0 || right > (int) n || left >= right) {
+      fprintf(stderr, "Sentence %d: ignoring span constraint %c%d:%d\n",
+              sentenceno, sign, left, right);
+      continue;
+    }
+    c = REALLOC(c, 3 * (nc + 1) * sizeof(int));
+    c[3*nc] = sign;
+    c[3*nc+1] = left;
+    c[3*nc+2] = right;
+    nc++;
+  }
+  if (nc == 0)
+    return NULL;
+
+  m = MALLOC(sizeof(struct coarse_mask));
+  m->n = n;
+  m->words = BITSET_WORDS(g->nnts);
+  m->allowed = CALLOC(nspans * m->words, sizeof(bitword));
+  m->spans = CALLOC(n+1, BITSET_BYTES(n+1));
+  for (j = 1; j <= n; j++)
+    for (i = 0; i < j; i++) {
+      for (k = 0; k < nc && j - i > 1; k++)
+        if (c[3*k] == '-' ? (int) i == c[3*k+1] && (int) j == c[3*k+2]
+            : CROSSES((int) i, (int) j, c[3*k+1], c[3*k+2]))
+          break;
+      if (j - i == 1 || k == nc) {
+        memset(COARSE_ALLOWED(m, i, j), 0xff, m->words * sizeof(bitword));
+        BITSET_SET(COARSE_SPAN_ROW(m, i), j);
+      }}
+  m->parsed = BITSET_TEST(COARSE_SPAN_ROW(m, 0), n);
+  FREE(c);
+  return m;
+}
+
+#define MASK_ALLOWS(allowed, id, g)	\
+  ((id) >= (g)->nnts || BITSET_TEST(allowed, id))
+
+static inline unsigned
+hash_mix(unsigned h, unsigned x)
+{
+  h ^= x + 0x9e3779b9 + (h << 6) + (h >> 2);
+  return h;
+}
+
+/* edge_key() returns the tie-breaking key of an edge for id ending at
+ * right_pos, which is identified by its children's labels and where
+ * they meet.  Children are always the trees of chart cells.
+ */
+static unsigned
+edge_key(unsigned id, const struct bintree *left, const struct bintree *right,
+         int right_pos)
+{
+  unsigned h = hash_mix(rand_seed, sentenceno);
+
+  h = hash_mix(h, id);
+  h = hash_mix(h, right_pos);
+  if (left)
+    h = hash_mix(hash_mix(h, left->label), ((const struct chart_cell *) left)->rightpos);
+  if (right)
+    h = hash_mix(h, right->label);
+  h ^= h >> 16;		/* finish as in MurmurHash3 */
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  return h ^ (h >> 16);
+}
+
 static chart_cell
-add_edge(sihashcc chart_entry, si_index label, bintree left, bintree right,
-         FLOAT lprob, int right_pos, sihashcc left_vertex)
+add_edge(centry chart_entry, si_index label, bintree left, bintree right,
+         FLOAT lprob, int right_pos, centry left_vertex, const grammar *g)
 {
-  chart_cell *cp = sihashcc_valuep(chart_entry, label);
-  chart_cell cc = *cp;
+  unsigned id = grammar_label_id(g, label);
+  chart_cell *cp, cc;
 
   edges_proposed++;
 
+  if (chart_entry->allowed && !MASK_ALLOWS(chart_entry->allowed, id, g))
+    return NULL;
+
+  if (chart_entry->pre_lprob && id < g->nnts 
+      && (right || grammar_label_id(g, left->label) >= g->nnts)
+      && lprob > chart_entry->pre_lprob[id])
+    chart_entry->pre_lprob[id] = lprob;	/* not a unary chain */
+
+  if (chart_entry->lprob) {	/* dense entries keep scores contiguously */
+    if (id < g->nnts && BITSET_TEST(chart_entry->present, id) 
+        && chart_entry->lprob[id] > lprob)
+      return NULL;
+  }
+
+  cp = centry_valuep(chart_entry, label, id, g);
+  cc = *cp;
+
   if (cc == NULL) {                   /* construct a new chart entry */
-    chart_cell *vertex_ptr = sihashcc_valuep(left_vertex, label);
+    chart_cell *vertex_ptr = centry_valuep(left_vertex, label, id, g);
     *cp = make_chart_cell(label, left, right, lprob, right_pos, *vertex_ptr);
     *vertex_ptr = *cp;
+    chart_entry->n++;
+    if (id < g->nnts) {
+      BITSET_SET(chart_entry->present, id);
+      BITSET_SET(left_vertex->present, id);
+      if (chart_entry->lprob)
+        chart_entry->lprob[id] = lprob;
+    }
+    else {
+      chart_entry->term = *cp;
+      left_vertex->term = *vertex_ptr;
+    }
     return *cp;
   }
 
@@ -173,15 +636,15 @@ add_edge(sihashcc chart_entry, si_index label, bintree left, bintree right,
     cc->tree.left = left;
     cc->tree.right = right;
     cc->lprob = lprob;
-    cc->nalt = 1;
+    if (chart_entry->lprob && id < g->nnts)
+      chart_entry->lprob[id] = lprob;
     return(cc);
   }
 
   /* old and new entries have same probability */
 
-  assert(cc->nalt<UINT_MAX);
-
-  if (rand() > RAND_MAX/(++(cc->nalt)))
+  if (edge_key(id, left, right, right_pos) 
+      >= edge_key(id, cc->tree.left, cc->tree.right, cc->rightpos))
     return NULL;
 
   cc->tree.left = left;	/* overwrite tree node */
@@ -204,196 +667,3251 @@ dump_chart(int n, chart* c, si_t si)
 */
 
 
-/* follow this unary rule */
+/* Unary rules are applied from the closure table computed by
+ * read_grammar(), so a unary edge's tree goes straight from the
+ * ancestor to the child at the bottom of the chain; unfold_unary()
+ * puts the intermediate nodes back when the tree is output.
+ */
+
+/* close_cell() adds an edge for every unary ancestor of child_cell */
 static void 
-follow_unary(chart_cell child_cell, sihashcc chart_entry, grammar g, 
-             int right_pos, sihashcc left_vertex)   
+close_cell(chart_cell child_cell, centry chart_entry, const grammar *g, 
+           int right_pos, centry left_vertex)   
 {
-  int	 i;
-  urules urs = sihashurs_ref(g.urs, child_cell->tree.label);
+  unsigned id = grammar_label_id(g, child_cell->tree.label);
+  size_t   i;
 
-  for (i=0; i<urs.n; i++) {
-    chart_cell parent_cell = add_edge(chart_entry, urs.e[i]->parent, 
-                                      &child_cell->tree, NULL,
-                                      child_cell->lprob + urs.e[i]->prob,
-                                      right_pos, left_vertex);
-
-    if (parent_cell)
-      follow_unary(parent_cell, chart_entry, g, right_pos, left_vertex);
-  }}
+  assert(id < g->nnts);
+  for (i = g->uchains_start[id]; i < g->uchains_start[id+1]; i++)
+    add_edge(chart_entry, g->id_label[g->uchains[i].parent], 
+             &child_cell->tree, NULL,
+             child_cell->lprob + g->uchains[i].prob,
+             right_pos, left_vertex, g);
+}
 
 
+/* apply_unary() closes chart_entry in a single pass over the word-wide
+ * AND of its labels and the nonterminals with unary ancestors.  Cells
+ * whose best analysis is itself a unary chain over a nonterminal are
+ * skipped, since the chain's bottom label is closed too and its
+ * closure covers everything above.
+ */
 static void
-apply_unary(sihashcc chart_entry, grammar g, int right_pos, 
-            sihashcc left_vertex)
+apply_unary(centry chart_entry, const grammar *g, int right_pos, 
+            centry left_vertex)
 {
-  sihashursit	ursit;
-  size_t	i;
+  size_t	w;
 
-  for (ursit=sihashursit_init(g.parent_urs); sihashursit_ok(ursit); 
-       ursit = sihashursit_next(ursit)) {
-    /* look up the rule's child category */
-    chart_cell c = sihashcc_ref(chart_entry, ursit.key);	
-    
-    if (c)			/* such categories exist in this cell */
-      for (i=0; i<ursit.value.n; i++) {
-        chart_cell cc = add_edge(chart_entry, ursit.value.e[i]->parent, 
-                                 &c->tree, NULL, 
-                                 c->lprob + ursit.value.e[i]->prob,
-                                 right_pos, left_vertex);
-        if (cc)
-          follow_unary(cc, chart_entry, g, right_pos, left_vertex);
-      }}}
+  for (w = 0; w < BITSET_WORDS(g->nnts); w++) {
+    bitword children = chart_entry->present[w] & g->unary_nts[w];
 
+    while (children) {
+      unsigned	 id = w*BITWORD_BITS + __builtin_ctzl(children);
+      chart_cell c = centry_id_ref(chart_entry, id, g);
 
-static void
-apply_binary(sihashcc left_entry, int left, int mid, chart c, grammar g)
-{
-  sihashbrsit	brsit;
-  size_t	i;
+      children &= children - 1;
+      if (c->tree.left && !c->tree.right 
+          && grammar_label_id(g, c->tree.left->label) < g->nnts)
+        continue;
+      close_cell(c, chart_entry, g, right_pos, left_vertex);
+    }}}
 
-  for (brsit=sihashbrsit_init(g.brs); sihashbrsit_ok(brsit); 
-       brsit = sihashbrsit_next(brsit)) {
-    /* look up the rule's left category */
-    chart_cell cl = sihashcc_ref(left_entry, brsit.key);
-    if (cl)	/* such categories exist in this cell */
-      for (i=0; i<brsit.value.n; i++) {
-        chart_cell cr;
-        for (cr = sihashcc_ref(c->vertex[mid], brsit.value.e[i]->right);
-             cr; cr = cr->next) 
-          add_edge(CHART_ENTRY(c,left,cr->rightpos), brsit.value.e[i]->parent,
-                   &cl->tree, &cr->tree,
-                   cl->lprob + cr->lprob +  brsit.value.e[i]->prob,
-                   cr->rightpos, c->vertex[left]);
-      }}}
 
-int sentenceno = 0;
+/* unfold_unary() returns a copy of t with the unary chains that the
+ * closure table skipped filled back in.
+ */
+static bintree unfold_chain(const bintree child, si_index ancestor, 
+                            const grammar *g);
 
-chart
-cky(struct vindex terms, grammar g, si_t si)
+static bintree
+unfold_unary(const bintree t, const grammar *g)
 {
-  int left, mid;
-  chart c;
+  bintree u;
 
-  c = chart_make(terms.n);
-  
-  /* insert lexical items */
+  if (!t)
+    return NULL;
 
-  for (left = 0; left < (int) terms.n; left++) {
-    si_index	label = terms.e[left];
-    sihashcc    chart_entry = CHART_ENTRY(c, left, left+1);
-    sihashcc    left_vertex = c->vertex[left];
-    chart_cell  cell = add_edge(chart_entry, label, NULL, NULL, 0.0, 
-                                left+1, left_vertex);    
-    
-    assert(cell);  /* check that cell was actually added */
-    follow_unary(cell, chart_entry, g, left+1, left_vertex);
+  u = NEW_BINTREE;
+  u->label = t->label;
+  if (t->left && !t->right) {	/* unary chain */
+    u->left = unfold_chain(t->left, t->label, g);
+    u->right = NULL;
+  }
+  else {
+    u->left = unfold_unary(t->left, g);
+    u->right = unfold_unary(t->right, g);
   }
+  return u;
+}
 
-  /* actually do syntactic rules! */
+/* unfold_chain() returns the unfolded subtree immediately below
+ * ancestor on the chain from child */
+static bintree
+unfold_chain(const bintree child, si_index ancestor, const grammar *g)
+{
+  si_index below = unary_below(g, child->label, ancestor);
+  bintree  u;
 
-  for (left = (int) terms.n-1; left >= 0; left--) {
-    for (mid = left+1; mid < (int) terms.n; mid++) {
-      if (verbose)
-        printf("SENTNO %d SPAN %d..%d\n", sentenceno, left, mid);
+  if (below == child->label)
+    return unfold_unary(child, g);
 
-      sihashcc chart_entry = CHART_ENTRY(c, left, mid);
-      /* unary close cell spanning from left to mid */
-      if (mid - left > 1)
-        apply_unary(chart_entry, g, mid, c->vertex[left]);
-      /* now apply binary rules */
-      apply_binary(chart_entry, left, mid, c, g);
-    }
-    /* apply unary rules to chart cells spanning from left to end of sentence
-     * there's no need to apply binary rules to these
-     */
-    apply_unary(CHART_ENTRY(c, left, terms.n), g, 
-                (int) terms.n, c->vertex[left]);
+  u = NEW_BINTREE;
+  u->label = below;
+  u->left = unfold_chain(child, below, g);
+  u->right = NULL;
+  return u;
+}
 
-/*
-    printf("Chart entry %d-%d\n", (int) left, (int) mid);
-    chart_entry_display(CHART_ENTRY(c,left,mid), si);
-*/
-  }
-  return c;
+
+/* Beam pruning (-k width, -p margin) removes nonterminal cells from a
+ * span's entry after apply_unary() has closed it and before it is used
+ * as a left or right child.  A cell is kept if it is among the width
+ * best in its entry (cells tied with the width'th best are kept too)
+ * and its log prob is within margin of the entry's best.  Pruned cells
+ * are only unlinked, since the trees of kept cells may point to them.
+ */
+
+int	beam_width = 0;		/* max cells per span, or 0 for no limit */
+double	beam_margin = HUGE_VAL;	/* max log prob below the span's best */
+__thread int edges_pruned = 0;
+
+#define BEAM_PRUNING	(!exhaustive && (beam_width > 0 || beam_margin < HUGE_VAL))
+
+static int
+lprob_desc_cmp(const void *p1, const void *p2)
+{
+  FLOAT x1 = *(const FLOAT *) p1, x2 = *(const FLOAT *) p2;
+
+  return x1 < x2 ? 1 : x1 > x2 ? -1 : 0;
 }
 
-static vindex
-read_terms(FILE *fp, si_t si)
+/* unlink_cell() removes nonterminal id's cell from e and from the list
+ * of cells starting at its left vertex */
+static void
+unlink_cell(centry e, centry left_vertex, unsigned id, const grammar *g)
 {
-  size_t i = 0, nsize = 10;
-  vindex v = make_vindex(nsize);
-  si_index term;
+  si_index   label = g->id_label[id];
+  chart_cell cell = centry_id_ref(e, id, g);
+  chart_cell *head = centry_valuep(left_vertex, label, id, g), *cp;
 
-  while ((term = read_cat_term(fp, si))) {
-    if (i >= nsize) {
-      nsize *= 2;
-      vindex_resize(v, nsize);
-    }
-    assert(i < nsize);
-    vindex_ref(v,i++) = term;
-  }
- 
-  if (i > 0) {
-    v->n = i;
-    vindex_resize(v, v->n);
-    return (v);
-  }
-  else {
-    vindex_free(v);
-    return(NULL);
-  }
+  for (cp = head; *cp != cell; cp = &(*cp)->next)
+    assert(*cp);
+  *cp = cell->next;
+  if (!*head)
+    BITSET_CLEAR(left_vertex->present, id);
+
+  if (e->ht)
+    sihashcc_set(e->ht, label, NULL);
+  else
+    e->cell[id] = NULL;
+  BITSET_CLEAR(e->present, id);
+  e->n--;
 }
 
- void usage() {
-  printf("llncky [-m maxsentlen] [-f from] [-t to] [-o outfile] [-l logfile] corpus grammar\n");
-  exit(EXIT_FAILURE);
+static void
+prune_entry(centry e, centry left_vertex, const grammar *g)
+{
+  FLOAT		*scores, cutoff = -HUGE_VAL;
+  size_t	id, n = 0;
+
+  scores = MALLOC_CHART(e->n * sizeof(FLOAT));
+  for (id = bitset_next(e->present, 0, g->nnts); id < g->nnts; 
+       id = bitset_next(e->present, id+1, g->nnts))
+    scores[n++] = centry_id_ref(e, id, g)->lprob;
+  if (n == 0)
+    return;
+
+  qsort(scores, n, sizeof(FLOAT), lprob_desc_cmp);
+  if (beam_margin < HUGE_VAL)
+    cutoff = scores[0] - beam_margin;
+  if (beam_width > 0 && n > (size_t) beam_width 
+      && scores[beam_width-1] > cutoff)
+    cutoff = scores[beam_width-1];
+
+  for (id = bitset_next(e->present, 0, g->nnts); id < g->nnts; 
+       id = bitset_next(e->present, id+1, g->nnts))
+    if (centry_id_ref(e, id, g)->lprob < cutoff) {
+      unlink_cell(e, left_vertex, id, g);
+      edges_pruned++;
+    }
 }
 
-int      
-main(int argc, char **argv)
+
+/* apply_binary() combines the cells in left_entry (spanning left..mid)
+ * with the cells starting at mid.  There are two loop orders:
+ *
+ *  grammar-driven: for each left child in g->brs, look it up in
+ *    left_entry (this was the only order originally)
+ *  cell-driven: for each label present in left_entry, look up the
+ *    binary rules it is the left child of in the packed rule store
+ *
+ * Both visit the same rules, but differ in the number of lookups that
+ * miss.  In auto mode (the default, -b auto) the cell-driven order is
+ * used when left_entry has fewer labels than g->brs has left children.
+ *
+ * Before either, the presence bitsets of the two entries are intersected
+ * with the grammar's left and right child bitsets, and nothing is done
+ * if either intersection is empty.  centry_ref() also tests the
+ * presence bitset before it probes.
+ */
+
+#define BINARY_GRAMMAR	0
+#define BINARY_CELL	1
+#define BINARY_AUTO	2
+
+int	binary_order = BINARY_AUTO;
+
+/* apply_binary_rules() combines cl, whose label has id lid, with the
+ * cells starting at mid.  Each child pair in the packed rule store is
+ * looked up once, and all of its parents are built from one run of
+ * g->bparents.
+ */
+static void
+apply_binary_rules(chart_cell cl, unsigned lid, int left, int mid, chart c, 
+                   const grammar *g)
 {
-  si_t          si = make_si(1024);
-  FILE          *grammarfp = stdin, *yieldfp = NULL;
-  FILE	        *tracefp = NULL;  	/* trace output */
-  FILE		*summaryfp = NULL;	/* end of parse stats output */
-  FILE		*parsefp = stdout;      /* parse trees */
-  FILE		*probfp = NULL;         /* max_neglog_prob */
+  const bpair	*bp, *end = g->bpairs + g->bleft_start[lid+1];
 
-  chart_cell	root_cell;
-  grammar	g;
-  chart		c;
-  vindex 	terms;
-  int		maxsentlen = 100;
-  int           parsed_sentences = 0, failed_sentences = 0;
-  int           sentfrom = 0, sentto = 0;
-  double	sum_neglog_prob = 0;
+  for (bp = g->bpairs + g->bleft_start[lid]; bp < end; bp++) {
+    chart_cell cr;
+    for (cr = centry_id_find(c->vertex[mid], bp->right, g); 
+         cr; cr = cr->next) {
+      centry	    entry;
+      FLOAT	    lprob = cl->lprob + cr->lprob;
+      const bparent *pp, *pend = g->bparents + bp[1].start;
 
-  srand(RAND_SEED);	/* seed random number generator */
+      if (c->mask && !BITSET_TEST(COARSE_SPAN_ROW(c->mask, left), cr->rightpos))
+        continue;	/* a prepass pruned this span */
+      if (!CHART_IN_BAND(c, left, cr->rightpos))
+        continue;	/* wider than -W allows */
+      entry = chart_span(c, left, cr->rightpos, g);
 
-  int arg;
-  opterr = 0;
+      for (pp = g->bparents + bp->start; pp < pend; pp++)
+        add_edge(entry, pp->parent, &cl->tree, &cr->tree,
+                 lprob + pp->prob, cr->rightpos, c->vertex[left], g);
+    }}}
 
-  while ((arg = getopt(argc,argv,"m:l:o:f:t:v")) != -1) { 
-    switch (arg) {
-    case 'm':
-      if (!sscanf(optarg, "%d", &maxsentlen)) {
-        fprintf(stderr, "%s: Couldn't parse maxsentlen %s\n", argv[0], optarg);
-        exit(EXIT_FAILURE);
-      }
-      break;
-    case 'f':
-      if (!sscanf(optarg, "%d", &sentfrom)) {
-        fprintf(stderr, "%s: Couldn't parse from %s\n", argv[0], optarg);
-        exit(EXIT_FAILURE);
-      }
-      break;
-    case 't':
-      if (!sscanf(optarg, "%d", &sentto)) {
-        fprintf(stderr, "%s: Couldn't parse from %s\n", argv[0], optarg);
-        exit(EXIT_FAILURE);
-      }
-      break;
+static void
+apply_binary(centry left_entry, int left, int mid, chart c, const grammar *g)
+{
+  int order = binary_order;
+  centry right_vertex = c->vertex[mid];
+  unsigned id;
+
+  if (!right_vertex)	/* no cells start at mid */
+    return;
+
+  if (!left_entry->term 
+      && !bitset_intersects(left_entry->present, g->left_nts, g->nnts))
+    return;		/* no left child in left_entry */
+  if (!right_vertex->term
+      && !bitset_intersects(right_vertex->present, g->right_nts, g->nnts))
+    return;		/* no right child starts at mid */
+
+  if (order == BINARY_AUTO)
+    order = left_entry->n < g->brs->size ? BINARY_CELL : BINARY_GRAMMAR;
+
+  if (order == BINARY_GRAMMAR) {
+    sihashbrsit	brsit;
+
+    for (brsit=sihashbrsit_init(g->brs); sihashbrsit_ok(brsit); 
+         brsit = sihashbrsit_next(brsit)) {
+      /* look up the rule's left category */
+      chart_cell cl = centry_id_find(left_entry, 
+                                     id = g->label_id[brsit.key], g);
+      if (cl)	/* such categories exist in this cell */
+        apply_binary_rules(cl, id, left, mid, c, g);
+    }}
+  else if (left_entry->ht) {
+    sihashcc		ht = left_entry->ht;
+    sihashcc_cell_ptr	p;
+    size_t		i;
+
+    for (i = 0; i < ht->tablesize; i++)
+      for (p = ht->table[i]; p; p = p->next)
+        if (p->value && (id = grammar_label_id(g, p->key)) != NO_ID)
+          apply_binary_rules(p->value, id, left, mid, c, g);
+  }
+  else {
+    for (id = bitset_next_and(left_entry->present, g->left_nts, 0, g->nnts); 
+         id < g->nnts;
+         id = bitset_next_and(left_entry->present, g->left_nts, id+1, g->nnts))
+      apply_binary_rules(left_entry->cell[id], id, left, mid, c, g);
+    if (left_entry->term 
+        && (id = grammar_label_id(g, left_entry->term->tree.label)) != NO_ID)
+      apply_binary_rules(left_entry->term, id, left, mid, c, g);
+  }}
+
+/* Lattice input (-L) reads each sentence as a word lattice, whose
+ * states are numbered so that every arc goes from a lower state to a
+ * higher one; the parse spans state 0 to the highest state, and each
+ * arc seeds the cell over its states.  A word arc gives its word and
+ * a log prob that is added to every edge built on it, and a tag arc
+ * gives a preterminal over a word, with a log prob added to the
+ * lexical rule's (tag arcs whose rule isn't in the grammar are
+ * dropped).  One parse covers every path through the lattice.
+ */
+typedef struct lattice_arc {
+  int		from, to;
+  si_index	word, tag;	/* tag is 0 in a word arc */
+  FLOAT		lprob;
+} lattice_arc;
+
+int		lattice_input = 0;
+lattice_arc	*lattice = NULL;	/* the current sentence's arcs */
+size_t		lattice_narcs = 0, lattice_nsize = 0;
+
+/* insert_lattice() puts the arcs of the lattice in c and closes the
+ * one-state spans under unary rules */
+static void
+insert_lattice(chart c, const grammar *g)
+{
+  size_t i, k;
+
+  for (i = 0; i < lattice_narcs; i++) {
+    lattice_arc	*a = lattice + i;
+    unsigned	id = grammar_label_id(g, a->word);
+    centry	entry, vertex;
+    chart_cell	cell;
+
+    if (a->to - a->from > 1 && c->mask
+        && !BITSET_TEST(COARSE_SPAN_ROW(c->mask, a->from), a->to))
+      continue;		/* a constraint forbids this span */
+    if (!CHART_IN_BAND(c, a->from, a->to))
+      continue;
+    entry = chart_span(c, a->from, a->to, g);
+    vertex = c->vertex[a->from];
+
+    if (!a->tag) {
+      cell = add_edge(entry, a->word, NULL, NULL, a->lprob, a->to, vertex, g);
+      if (cell && id != NO_ID)
+        for (k = 0; k < g->child_urs[id].n; k++)
+          add_edge(entry, g->child_urs[id].e[k]->parent, &cell->tree, NULL,
+                   cell->lprob + g->child_urs[id].e[k]->prob, a->to, vertex, g);
+    }
+    else if (id != NO_ID)
+      for (k = 0; k < g->child_urs[id].n; k++)
+        if (g->child_urs[id].e[k]->parent == a->tag) {
+          /* the word is only under this tag, so it isn't in entry */
+          cell = make_chart_cell(a->word, NULL, NULL, 0.0, a->to, NULL);
+          add_edge(entry, a->tag, &cell->tree, NULL, 
+                   a->lprob + g->child_urs[id].e[k]->prob, a->to, vertex, g);
+          break;
+        }
+  }
+
+  for (i = 0; i < c->n; i++)
+    if (CHART_ENTRY(c, i, i+1))
+      apply_unary(CHART_ENTRY(c, i, i+1), g, i+1, c->vertex[i]);
+}
+
+/* insert_word() puts the word label at left in c, with its
+ * preterminals and their unary closure */
+static void
+insert_word(chart c, int left, si_index label, const grammar *g)
+{
+  centry      chart_entry = chart_span(c, left, left+1, g);
+  centry      left_vertex = c->vertex[left];
+  chart_cell  cell = add_edge(chart_entry, label, NULL, NULL, 0.0, 
+                              left+1, left_vertex, g);    
+  unsigned    id = grammar_label_id(g, label);
+    
+  assert(cell);  /* check that cell was actually added */
+  if (id != NO_ID) {
+    /* one unary step to the preterminals, then close from those */
+    urules	urs = g->child_urs[id];
+    size_t	i;
+
+    for (i = 0; i < urs.n; i++)
+      if (TAG_ALLOWED(left, urs.e[i]->parent, g))
+        add_edge(chart_entry, urs.e[i]->parent, &cell->tree, NULL,
+                 urs.e[i]->prob, left+1, left_vertex, g);
+    apply_unary(chart_entry, g, left+1, left_vertex);
+  }
+}
+
+/* Wavefront parsing (-J N) builds a long sentence's spans a width at a
+ * time on N threads.  Each span pulls its children from the narrower
+ * spans, which are finished by then, so a span only writes to its own
+ * entry and to the vertex at its left end, which no other span of its
+ * width shares, and no locks are needed on the chart.  A span's splits
+ * are divided into runs of WAVEFRONT_SPLITS; each run is a task that
+ * finds the best edge for each parent over its splits, and then each
+ * span is a task that adds its runs' edges in order, closes and prunes
+ * it.  Ties are broken by edge_key() within each run as well as in
+ * add_edge(), so the parses are the same as the serial parser's.
+ */
+
+#define WAVEFRONT_MIN_WORDS	16	/* shorter sentences are parsed serially */
+#define WAVEFRONT_SPLITS	8	/* splits per task */
+
+int	wavefront_threads = 1;	/* -J N */
+
+/* A pool's threads and the caller of pool_run() run tasks 0 .. ntasks-1,
+ * each taking the next one no thread has taken.  The threads stay
+ * around between runs, and keep their chart memory and counters until
+ * pool_collect() hands them to the caller.
+ *
+ * A shared counter does as well as work stealing would here: a round's
+ * tasks are independent and take about 70us each on a treebank
+ * grammar, so a lock per task is cheap.  Replaying the recorded task
+ * times of 20 sentences of 30+ words, the rounds finish within 1%, 4%
+ * and 9% of the best any scheduler could do (the longer of the
+ * longest task and an even share) on 2, 4 and 8 threads.
+ */
+typedef struct pool {
+  int		nthreads;	/* threads besides the caller */
+  pthread_t	*threads;
+  pthread_mutex_t lock;
+  pthread_cond_t  start, done;
+  void		(*task)(void *arg, int i, int t);
+  void		*arg;
+  int		ntasks, next, running, round, collect, quit;
+  int		exhaustive, sentenceno;	/* the caller's */
+  struct blockalloc *blocks;	/* the threads' chart memory */
+  int		edges_proposed, cells_probed, edges_pruned;
+  long		mmm_blocks;	/* the threads' mmm_blocks_allocated */
+} *pool;
+
+typedef struct pool_thread_arg {
+  pool	p;
+  int	t;
+} pool_thread_arg;
+
+pool	wavefront_pool = NULL;
+
+/* pool_tasks() runs tasks until there are none left; p->lock is held */
+static void
+pool_tasks(pool p, int t)
+{
+  while (p->next < p->ntasks) {
+    int i = p->next++;
+
+    pthread_mutex_unlock(&p->lock);
+    p->task(p->arg, i, t);
+    pthread_mutex_lock(&p->lock);
+  }
+}
+
+static void *
+pool_thread(void *arg)
+{
+  pool	p = ((pool_thread_arg *) arg)->p;
+  int	t = ((pool_thread_arg *) arg)->t, round = 0;
+
+  FREE(arg);
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->round == round && !p->quit)
+      pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit)
+      break;
+    round = p->round;
+    exhaustive = p->exhaustive;
+    sentenceno = p->sentenceno;
+    pool_tasks(p, t);
+    if (p->collect) {
+      blockalloc_give(p->blocks);	/* splice ours onto the others' */
+      p->blocks = blockalloc_take();
+      p->edges_proposed += edges_proposed;
+      p->cells_probed += cells_probed;
+      p->edges_pruned += edges_pruned;
+      edges_proposed = cells_probed = edges_pruned = 0;
+    }
+    if (--p->running == 0)
+      pthread_cond_signal(&p->done);
+  }
+  p->mmm_blocks += mmm_blocks_allocated;
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+static pool
+make_pool(int nthreads)
+{
+  pool	p = MALLOC(sizeof(struct pool));
+  int	t;
+
+  p->nthreads = nthreads;
+  p->threads = MALLOC(nthreads * sizeof(pthread_t));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->ntasks = p->next = p->running = p->round = p->collect = p->quit = 0;
+  p->blocks = NULL;
+  p->edges_proposed = p->cells_probed = p->edges_pruned = 0;
+  p->mmm_blocks = 0;
+  for (t = 0; t < nthreads; t++) {
+    pool_thread_arg *a = MALLOC(sizeof(pool_thread_arg));
+
+    a->p = p;
+    a->t = t+1;		/* the caller is thread 0 */
+    if (pthread_create(p->threads + t, NULL, pool_thread, a)) {
+      fprintf(stderr, "make_pool() in llncky.c: Couldn't create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return p;
+}
+
+static void
+free_pool(pool p)
+{
+  int t;
+
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  for (t = 0; t < p->nthreads; t++)
+    pthread_join(p->threads[t], NULL);
+  mmm_blocks_allocated += p->mmm_blocks;
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->start);
+  pthread_cond_destroy(&p->done);
+  FREE(p->threads);
+  FREE(p);
+}
+
+/* pool_round() starts a round on p's threads, joins in, and waits for
+ * them to finish it */
+static void
+pool_round(pool p, int ntasks, int collect)
+{
+  pthread_mutex_lock(&p->lock);
+  p->ntasks = ntasks;
+  p->next = 0;
+  p->collect = collect;
+  p->running = p->nthreads;
+  p->exhaustive = exhaustive;
+  p->sentenceno = sentenceno;
+  p->round++;
+  pthread_cond_broadcast(&p->start);
+  pool_tasks(p, 0);
+  while (p->running > 0)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
+
+/* pool_run() runs task(arg, i, t) for i in 0 .. ntasks-1, where t is
+ * the number of the thread running it (0 .. p->nthreads) */
+static void
+pool_run(pool p, void (*task)(void *arg, int i, int t), void *arg, int ntasks)
+{
+  p->task = task;
+  p->arg = arg;
+  pool_round(p, ntasks, 0);
+}
+
+/* pool_collect() gives the caller the chart memory and counters the
+ * threads have used since the last collection */
+static void
+pool_collect(pool p)
+{
+  pool_round(p, 0, 1);
+  blockalloc_give(p->blocks);
+  p->blocks = NULL;
+  edges_proposed += p->edges_proposed;
+  cells_probed += p->cells_probed;
+  edges_pruned += p->edges_pruned;
+  p->edges_proposed = p->cells_probed = p->edges_pruned = 0;
+}
+
+typedef struct wf_edge {
+  unsigned	id;
+  FLOAT		lprob;
+  chart_cell	left, right;
+} wf_edge;
+
+typedef struct wf_run {		/* splits mid0 .. mid1-1 of left..right */
+  int		left, right, mid0, mid1;
+  wf_edge	*edges;
+  size_t	nedges;
+} wf_run;
+
+typedef struct wf_cell {	/* a finished span's cell that is a left child */
+  chart_cell	cell;
+  unsigned	id;
+} wf_cell;
+
+typedef struct wavefront {
+  chart		c;
+  const grammar	*g;
+  int		width;
+  wf_run	*runs;
+  int		*span_runs;	/* runs of span i are span_runs[i] .. span_runs[i+1]-1 */
+  wf_cell	**lefts;	/* lefts[CHART_INDEX(c, i, j)] are i..j's left children ... */
+  size_t	*nlefts;	/* ... and there are this many */
+  wf_edge	*best;		/* best[t*nnts + id] for thread t */
+  unsigned	*touched;	/* touched[t*nnts ..], ids with a best edge */
+  double	deadline;	/* the parsing thread's (see deadline.h) */
+} wavefront;
+
+/* A run's best edge for each parent is kept in a dense array of the
+ * thread's, and the ids touched are listed so they can be collected
+ * and cleared. */
+typedef struct wf_best {
+  wf_edge	*best;
+  unsigned	*touched;
+  size_t	ntouched;
+  const bitword	*allowed;	/* the span's allowed labels, or NULL */
+} wf_best;
+
+/* wf_pair() proposes the parents of child pair k over cl and cr */
+static void
+wf_pair(size_t k, chart_cell cl, chart_cell cr, wf_best *wb, const grammar *g)
+{
+  const bparent	*pp, *pend = g->bparents + g->bpairs[k+1].start;
+
+  for (pp = g->bparents + g->bpairs[k].start; pp < pend; pp++) {
+    FLOAT	lprob = cl->lprob + cr->lprob + pp->prob;
+    unsigned	id = grammar_label_id(g, pp->parent);
+    wf_edge	*b = wb->best + id;
+
+    if (wb->allowed && !BITSET_TEST(wb->allowed, id))
+      continue;
+    if (b->left && (b->lprob > lprob 
+                    || (b->lprob == lprob
+                        && edge_key(id, &cl->tree, &cr->tree, cr->rightpos)
+                           >= edge_key(id, &b->left->tree, &b->right->tree,
+                                       cr->rightpos))))
+      continue;
+    if (!b->left)
+      wb->touched[wb->ntouched++] = id;
+    b->id = id;
+    b->lprob = lprob;
+    b->left = cl;
+    b->right = cr;
+  }}
+
+/* wf_left() combines cl, whose label has id lid, with the cells in re */
+static void
+wf_left(chart_cell cl, unsigned lid, centry re, wf_best *wb, const grammar *g)
+{
+  size_t	k;
+  chart_cell	cr;
+
+  for (k = g->bleft_start[lid]; k < g->bleft_start[lid+1]; k++)
+    if ((g->bpairs[k].right < g->nnts || re->term)
+        && (cr = centry_id_find(re, g->bpairs[k].right, g)))
+      wf_pair(k, cl, cr, wb, g);
+}
+
+/* wf_lefts() lists the cells of finished span left..right that are
+ * left children, so the spans it is a left child of needn't look them
+ * up for every split */
+static void
+wf_lefts(wavefront *wf, int left, int right)
+{
+  const grammar	*g = wf->g;
+  centry	e = CHART_ENTRY(wf->c, left, right);
+  size_t	ix = CHART_INDEX(wf->c, left, right), n = 0;
+  wf_cell	*cells;
+  unsigned	id;
+
+  if (!e || !e->n)
+    return;
+  cells = MALLOC_CHART(e->n * sizeof(wf_cell));
+  for (id = bitset_next_and(e->present, g->left_nts, 0, g->nnts); id < g->nnts;
+       id = bitset_next_and(e->present, g->left_nts, id+1, g->nnts)) {
+    cells[n].cell = centry_id_ref(e, id, g);
+    cells[n++].id = id;
+  }
+  if (e->term && (id = grammar_label_id(g, e->term->tree.label)) != NO_ID) {
+    cells[n].cell = e->term;
+    cells[n++].id = id;
+  }
+  wf->lefts[ix] = cells;
+  wf->nlefts[ix] = n;
+}
+
+/* wf_splits() is the task for run i: it finds the best edge for each
+ * parent over the run's splits */
+static void
+wf_splits(void *arg, int i, int t)
+{
+  wavefront	*wf = arg;
+  const grammar	*g = wf->g;
+  chart		c = wf->c;
+  wf_run	*run = wf->runs + i;
+  wf_best	wb;
+  size_t	k;
+  int		mid;
+
+  if (wf->deadline > 0 && seconds(CLOCK_MONOTONIC) > wf->deadline) {
+    run->nedges = 0;	/* the width's PAST_DEADLINE will see it too */
+    run->edges = NULL;
+    return;
+  }
+  wb.best = wf->best + t*g->nnts;
+  wb.touched = wf->touched + t*g->nnts;
+  wb.ntouched = 0;
+  wb.allowed = c->mask ? COARSE_ALLOWED(c->mask, run->left, run->right) : NULL;
+
+  for (mid = run->mid0; mid < run->mid1; mid++) {
+    centry	le = CHART_ENTRY(c, run->left, mid);
+    centry	re = CHART_ENTRY(c, mid, run->right);
+
+    if (!le || !re)
+      continue;
+    for (k = 0; k < wf->nlefts[CHART_INDEX(c, run->left, mid)]; k++)
+      wf_left(wf->lefts[CHART_INDEX(c, run->left, mid)][k].cell,
+              wf->lefts[CHART_INDEX(c, run->left, mid)][k].id, re, &wb, g);
+  }
+
+  run->nedges = wb.ntouched;
+  run->edges = wb.ntouched ? MALLOC(wb.ntouched * sizeof(wf_edge)) : NULL;
+  for (k = 0; k < wb.ntouched; k++) {
+    run->edges[k] = wb.best[wb.touched[k]];
+    wb.best[wb.touched[k]].left = NULL;
+  }
+}
+
+/* wf_span() is the task for span i of the width: it adds its runs'
+ * edges to its entry, then closes and prunes it */
+static void
+wf_span(void *arg, int i, int t)
+{
+  wavefront	*wf = arg;
+  const grammar	*g = wf->g;
+  chart		c = wf->c;
+  int		right = i + wf->width, r;
+  size_t	k;
+  centry	e;
+
+  for (r = wf->span_runs[i]; r < wf->span_runs[i+1]; r++) {
+    wf_run *run = wf->runs + r;
+
+    for (k = 0; k < run->nedges; k++)
+      add_edge(chart_span(c, i, right, g), g->id_label[run->edges[k].id],
+               &run->edges[k].left->tree, &run->edges[k].right->tree,
+               run->edges[k].lprob, right, c->vertex[i], g);
+    if (run->edges)
+      FREE(run->edges);
+  }
+
+  if (!(e = CHART_ENTRY(c, i, right)))
+    return;
+  apply_unary(e, g, right, c->vertex[i]);
+  if (BEAM_PRUNING && !(i == 0 && right == (int) c->n))
+    prune_entry(e, c->vertex[i], g);	/* the root is never pruned */
+  wf_lefts(wf, i, right);
+}
+
+/* cky_wavefront() builds the spans of c wider than a word, whose
+ * one-word spans are already closed */
+static void
+cky_wavefront(chart c, const grammar *g)
+{
+  int		n = c->n, maxwidth = c->w ? (int) c->w : n, i, mid, nruns;
+  wavefront	wf;
+  size_t	nbest = (wavefront_pool->nthreads + 1) * g->nnts, k;
+
+  wf.c = c;
+  wf.g = g;
+  wf.deadline = deadline;
+  wf.runs = MALLOC(n * (n/WAVEFRONT_SPLITS + 1) * sizeof(wf_run));
+  wf.span_runs = MALLOC((n+1) * sizeof(int));
+  wf.best = MALLOC(nbest * sizeof(wf_edge));
+  wf.touched = MALLOC(nbest * sizeof(unsigned));
+  for (k = 0; k < nbest; k++)
+    wf.best[k].left = NULL;
+
+  wf.lefts = CALLOC(CHART_NENTRIES(c), sizeof(wf_cell *));
+  wf.nlefts = CALLOC(CHART_NENTRIES(c), sizeof(size_t));
+  for (i = 0; i < n; i++)
+    if (CHART_ENTRY(c, i, i+1)) {
+      if (BEAM_PRUNING)
+        prune_entry(CHART_ENTRY(c, i, i+1), c->vertex[i], g);
+      wf_lefts(&wf, i, i+1);
+    }
+
+  /* the deadline is checked after the last width too, in case its
+   * runs gave up */
+  for (wf.width = 2; !PAST_DEADLINE && wf.width <= maxwidth; wf.width++) {
+    nruns = 0;
+    for (i = 0; i + wf.width <= n; i++) {
+      wf.span_runs[i] = nruns;
+      if (c->mask && !BITSET_TEST(COARSE_SPAN_ROW(c->mask, i), i + wf.width))
+        continue;	/* a prepass pruned this span */
+      for (mid = i+1; mid < i + wf.width; mid += WAVEFRONT_SPLITS) {
+        wf_run *run = wf.runs + nruns++;
+
+        run->left = i;
+        run->right = i + wf.width;
+        run->mid0 = mid;
+        run->mid1 = mid + WAVEFRONT_SPLITS < run->right ? 
+          mid + WAVEFRONT_SPLITS : run->right;
+      }
+    }
+    wf.span_runs[i] = nruns;
+    pool_run(wavefront_pool, wf_splits, &wf, nruns);
+    pool_run(wavefront_pool, wf_span, &wf, n - wf.width + 1);
+  }
+  pool_collect(wavefront_pool);
+
+  FREE(wf.runs);
+  FREE(wf.span_runs);
+  FREE(wf.lefts);
+  FREE(wf.nlefts);
+  FREE(wf.best);
+  FREE(wf.touched);
+}
+
+chart
+cky(struct vindex terms, grammar g, si_t si, coarse_mask mask)
+{
+  int left, mid;
+  chart c;
+
+  c = chart_make(terms.n, mask);
+  if (mask && !mask->parsed)
+    return c;		/* a prepass found there is no parse */
+  
+  /* insert lexical items */
+
+  if (lattice_input)
+    insert_lattice(c, &g);
+  else for (left = 0; left < (int) terms.n; left++)
+    insert_word(c, left, terms.e[left], &g);
+
+  if (wavefront_pool && terms.n >= WAVEFRONT_MIN_WORDS) {
+    cky_wavefront(c, &g);
+    return c;
+  }
+
+  /* actually do syntactic rules! */
+
+  for (left = (int) terms.n-1; left >= 0 && !PAST_DEADLINE; left--) {
+    /* skip empty spans; entries further along this row can be made
+     * by apply_binary() as we go, so re-scan from mid each time */
+    for (mid = span_next(c, left, left+1); mid < (int) terms.n && !PAST_DEADLINE;
+         mid = span_next(c, left, mid+1)) {
+      if (verbose)
+        printf("SENTNO %d SPAN %d..%d\n", sentenceno, left, mid);
+
+      centry chart_entry = CHART_ENTRY(c, left, mid);
+      /* unary close cell spanning from left to mid */
+      if (mid - left > 1)
+        apply_unary(chart_entry, &g, mid, c->vertex[left]);
+      if (BEAM_PRUNING)
+        prune_entry(chart_entry, c->vertex[left], &g);
+      /* now apply binary rules */
+      apply_binary(chart_entry, left, mid, c, &g);
+    }
+    /* apply unary rules to chart cells spanning from left to end of sentence
+     * there's no need to apply binary rules to these
+     */
+    if (CHART_IN_BAND(c, left, terms.n) && CHART_ENTRY(c, left, terms.n)
+        && !PAST_DEADLINE) {	/* else its binary edges may be missing */
+      apply_unary(CHART_ENTRY(c, left, terms.n), &g, 
+                  (int) terms.n, c->vertex[left]);
+      /* the root is never pruned */
+      if (BEAM_PRUNING && left > 0)
+        prune_entry(CHART_ENTRY(c, left, terms.n), c->vertex[left], &g);
+    }
+
+/*
+    printf("Chart entry %d-%d\n", (int) left, (int) mid);
+    chart_entry_display(CHART_ENTRY(c,left,mid), si);
+*/
+  }
+  return c;
+}
+
+/* Incremental parsing (-I) reads each sentence a word at a time, and
+ * builds every span ending at a word as soon as it is read, so the
+ * chart of the words so far is always complete and its root is the
+ * parse of that prefix (which -l logs after every word).  The chart
+ * grows a column at a time, which the triangular layout allows.  It
+ * is cky() mirrored: the spans ending at the new word are finished
+ * from the shortest to the longest, and each is combined as a right
+ * child with the cells ending where it starts, which are kept in
+ * lists by end and label.  A span starting at 0 is pruned (and put in
+ * the lists) when the next word arrives, since until then it might
+ * be the root.
+ */
+int	incremental = 0;
+
+typedef struct end_cell {
+  chart_cell	  cell;
+  int		  left;
+  struct end_cell *next;
+} *end_cell;
+
+end_cell	*ends = NULL;	/* ends[j*nnts + id] end at j with label id */
+size_t		nends = 0;
+
+/* chart_extend() adds a column to c for one more word */
+static void
+chart_extend(chart c, const grammar *g)
+{
+  size_t  n = c->n + 1, i;
+  bitword *spans = CALLOC(n+1, BITSET_BYTES(n+1));
+
+  assert(!c->w && !c->mask);
+  c->cell = REALLOC(c->cell, CHART_SIZE(n) * sizeof(centry));
+  for (i = CHART_SIZE(c->n); i < CHART_SIZE(n); i++)
+    c->cell[i] = NULL;
+  c->vertex = REALLOC(c->vertex, (n+1) * sizeof(centry));
+  c->vertex[n] = NULL;
+  for (i = 0; i <= c->n; i++)	/* the span rows are one bit longer */
+    memcpy(spans + i*BITSET_WORDS(n+1), SPAN_ROW(c, i), BITSET_BYTES(c->n+1));
+  FREE(c->spans);
+  c->spans = spans;
+  c->n = n;
+
+  if (nends < (n+1) * g->nnts) {
+    nends = 2 * (n+1) * g->nnts;
+    ends = REALLOC(ends, nends * sizeof(end_cell));
+  }
+  for (i = n == 1 ? 0 : n; i <= n; i++)
+    memset(ends + i*g->nnts, 0, g->nnts * sizeof(end_cell));
+}
+
+/* finish_span() puts the cells of left..right in the lists of cells
+ * ending at right */
+static void
+finish_span(chart c, int left, int right, const grammar *g)
+{
+  centry   e = CHART_ENTRY(c, left, right);
+  unsigned id;
+
+  for (id = bitset_next_and(e->present, g->left_nts, 0, g->nnts); id < g->nnts;
+       id = bitset_next_and(e->present, g->left_nts, id+1, g->nnts)) {
+    end_cell ec = MALLOC_CHART(sizeof(struct end_cell));
+
+    ec->cell = centry_id_ref(e, id, g);
+    ec->left = left;
+    ec->next = ends[right*g->nnts + id];
+    ends[right*g->nnts + id] = ec;
+  }
+}
+
+/* combine_ends() builds the parents of cr, whose label has id rid and
+ * which spans mid..right, and each left child ending at mid.
+ */
+static void
+combine_ends(chart c, chart_cell cr, unsigned rid, int mid, int right,
+             const grammar *g)
+{
+  chart_cell word = mid > 0 ? CHART_ENTRY(c, mid-1, mid)->term : NULL;
+  size_t     x;
+
+  for (x = g->bright_start[rid]; x < g->bright_start[rid+1]; x++) {
+    size_t	  k = g->bright_pairs[x];
+    unsigned	  lid = g->bpair_left[k];
+    const bparent *pp, *pend = g->bparents + g->bpairs[k+1].start;
+    end_cell	  ec, wc = NULL, *head = &wc;
+
+    if (lid < g->nnts)
+      head = ends + mid*g->nnts + lid;
+    else if (word && grammar_label_id(g, word->tree.label) == lid) {
+      wc = MALLOC_CHART(sizeof(struct end_cell));	/* the word at mid-1 */
+      wc->cell = word;
+      wc->left = mid-1;
+      wc->next = NULL;
+    }
+    for (ec = *head; ec; ec = ec->next) {
+      centry entry = chart_span(c, ec->left, right, g);
+      FLOAT  lprob = ec->cell->lprob + cr->lprob;
+
+      for (pp = g->bparents + g->bpairs[k].start; pp < pend; pp++)
+        add_edge(entry, pp->parent, &ec->cell->tree, &cr->tree,
+                 lprob + pp->prob, right, c->vertex[ec->left], g);
+    }}
+}
+
+/* parse_word() adds the word label to the end of c, and builds every
+ * span ending at it.
+ */
+static void
+parse_word(chart c, si_index label, const grammar *g)
+{
+  int	   right, mid;
+  unsigned id;
+  centry   e;
+
+  chart_extend(c, g);
+  right = c->n;
+  if (right > 1 && (e = CHART_ENTRY(c, 0, right-1))) {
+    if (BEAM_PRUNING)		/* it isn't the root's span after all */
+      prune_entry(e, c->vertex[0], g);
+    finish_span(c, 0, right-1, g);
+  }
+  insert_word(c, right-1, label, g);
+
+  for (mid = right-1; mid > 0; mid--) {
+    if (!(e = CHART_ENTRY(c, mid, right)))
+      continue;
+    if (right - mid > 1)
+      apply_unary(e, g, right, c->vertex[mid]);
+    if (BEAM_PRUNING)
+      prune_entry(e, c->vertex[mid], g);
+    finish_span(c, mid, right, g);
+
+    for (id = bitset_next_and(e->present, g->right_nts, 0, g->nnts); 
+         id < g->nnts;
+         id = bitset_next_and(e->present, g->right_nts, id+1, g->nnts))
+      combine_ends(c, centry_id_ref(e, id, g), id, mid, right, g);
+    if (e->term && (id = grammar_label_id(g, e->term->tree.label)) != NO_ID)
+      combine_ends(c, e->term, id, mid, right, g);
+  }
+  if (right > 1 && (e = CHART_ENTRY(c, 0, right)))
+    apply_unary(e, g, right, c->vertex[0]);
+}
+
+/* read_incrementally() parses the next sentence of fp as it reads it,
+ * setting *cp to its chart and returning its words, or NULL at the end
+ * of fp.  Words after the first maxsentlen (if it's not 0) are read
+ * but not parsed.
+ */
+static vindex
+read_incrementally(FILE *fp, si_t si, const grammar *g, chart *cp,
+                   int maxsentlen, FILE *tracefp)
+{
+  size_t   i = 0, nsize = 10;
+  vindex   v = make_vindex(nsize);
+  si_index term;
+  chart	   c = chart_make(0, NULL);
+
+  sentenceno++;		/* main() counts the sentence once it is read */
+  while ((term = read_cat_term(fp, si))) {
+    if (i >= nsize) {
+      nsize *= 2;
+      vindex_resize(v, nsize);
+    }
+    vindex_ref(v, i++) = term;
+    if (!maxsentlen || (int) i <= maxsentlen) {
+      clock_t	 start = clock();
+      chart_cell root;
+
+      parse_word(c, term, g);
+      if (tracefp) {
+        root = CHART_ENTRY(c, 0, c->n) ? 
+          centry_ref(CHART_ENTRY(c, 0, c->n), g->root_label, g) : NULL;
+        fprintf(tracefp, "%d: word %lu: root %g, %g seconds\n", 
+                sentenceno, (unsigned long) i, 
+                root ? (double) root->lprob : -HUGE_VAL,
+                (double) (clock() - start) / CLOCKS_PER_SEC);
+      }}}
+  sentenceno--;
+
+  if (i == 0) {
+    vindex_free(v);
+    chart_free(c, 0);
+    return NULL;
+  }
+  v->n = i;
+  vindex_resize(v, v->n);
+  *cp = c;
+  return v;
+}
+
+/* A* parsing (-a) pops edges off an agenda in order of inside score
+ * plus an outside estimate, and stops when the root spanning the whole
+ * sentence is popped.  The estimate of label id over i..j is the best
+ * outside score over i..j in this sentence of id's coarse label, in a
+ * coarse grammar whose labels are the fine ones without their parent
+ * annotation (see project_label()) and whose rules score the best of
+ * the fine rules they project.  Every fine parse projects onto a coarse
+ * parse that scores at least as well, so the estimate is consistent:
+ * the first edge popped for a span and label is its Viterbi edge, and
+ * A* returns exactly cky()'s score.  Edges are only added to the chart
+ * when they are popped.
+ *
+ * The coarse inside and outside scores take O(n^3) time in the length
+ * n of the sentence and the number of coarse rules.  Nothing is pushed
+ * or combined over a span with no coarse outside score, or if it can't
+ * do better than the best root pushed so far.
+ */
+
+typedef struct astar_brule {
+  unsigned	parent, left, right;	/* coarse ids; terminal t is ncoarse+t */
+  FLOAT		prob;
+} astar_brule;
+
+typedef struct astar_uchain {
+  unsigned	parent;
+  FLOAT		prob;
+} astar_uchain;
+
+typedef struct astar_estimates {
+  const grammar	*g;		/* the whole grammar, even with -r */
+  size_t	ncoarse;	/* coarse labels */
+  unsigned	*coarse;	/* coarse[id] is nonterminal id's coarse label */
+  astar_brule	*brules;	/* sorted by left child */
+  size_t	nbrules;
+  size_t	*uchains_start;	/* the best chains up from coarse label x are */
+  astar_uchain	*uchains;	/* uchains[uchains_start[x]..uchains_start[x+1]-1] */
+} *astar_estimates;
+
+#define ASTAR_SPAN(i, j)	((j)*((j)-1)/2+(i))
+
+int		astar = 0;		/* parse with A* instead of cky() */
+astar_estimates	astar_est = NULL;
+__thread int	edges_pushed = 0;
+
+#define ASTAR_NONE	(-1e30)		/* finite, because of -ffast-math */
+
+typedef struct astar_label {
+  si_index	label;
+  unsigned	id;
+} astar_label;
+
+static int
+astar_label_cmp(const void *x, const void *y)
+{
+  si_index a = ((const astar_label *) x)->label;
+  si_index b = ((const astar_label *) y)->label;
+
+  return a < b ? -1 : a > b;
+}
+
+static int
+astar_brule_cmp(const void *x, const void *y)
+{
+  const astar_brule *a = x, *b = y;
+
+  if (a->left != b->left)
+    return a->left < b->left ? -1 : 1;
+  if (a->right != b->right)
+    return a->right < b->right ? -1 : 1;
+  return a->parent < b->parent ? -1 : a->parent > b->parent;
+}
+
+/* astar_close_unary() finds the best chain of coarse unary rules from
+ * every coarse label up to each of its ancestors, as close_unary()
+ * does for the fine grammar; up[ustart[x]..ustart[x+1]-1] are the
+ * unary rules over x.
+ */
+static void
+astar_close_unary(astar_estimates e, const size_t *ustart, const astar_uchain *up)
+{
+  size_t	nc = e->ncoarse, child, i, head, tail, ntouched, n = 0, nsize = nc;
+  FLOAT		*best = MALLOC(nc * sizeof(FLOAT));
+  unsigned	*queue = MALLOC((nc + 1) * sizeof(unsigned));
+  char		*queued = CALLOC(nc, sizeof(char));
+  unsigned	*touched = MALLOC(nc * sizeof(unsigned));
+
+  e->uchains_start = MALLOC((nc + 1) * sizeof(size_t));
+  e->uchains = MALLOC(nsize * sizeof(astar_uchain));
+  for (i = 0; i < nc; i++)
+    best[i] = -HUGE_VAL;
+
+  for (child = 0; child < nc; child++) {
+    e->uchains_start[child] = n;
+    best[child] = 0;
+    queue[0] = child;
+    queued[child] = 1;
+    head = 0;
+    tail = 1;
+    touched[0] = child;
+    ntouched = 1;
+
+    while (head != tail) {
+      unsigned x = queue[head];
+
+      head = (head + 1) % (nc + 1);
+      queued[x] = 0;
+      for (i = ustart[x]; i < ustart[x+1]; i++) {
+        unsigned p = up[i].parent;
+        FLOAT	 prob = best[x] + up[i].prob;
+
+        if (p == child || prob <= best[p])
+          continue;
+        if (best[p] == -HUGE_VAL)
+          touched[ntouched++] = p;
+        best[p] = prob;
+        if (!queued[p]) {
+          queue[tail] = p;
+          tail = (tail + 1) % (nc + 1);
+          queued[p] = 1;
+        }}}
+
+    for (i = 0; i < ntouched; i++) {
+      unsigned p = touched[i];
+
+      if (p != child) {
+        if (n >= nsize) {
+          nsize *= 2;
+          e->uchains = REALLOC(e->uchains, nsize * sizeof(astar_uchain));
+        }
+        e->uchains[n].parent = p;
+        e->uchains[n].prob = best[p];
+        n++;
+      }
+      best[p] = -HUGE_VAL;
+    }}
+  e->uchains_start[nc] = n;
+
+  FREE(best);
+  FREE(queue);
+  FREE(queued);
+  FREE(touched);
+}
+
+static astar_estimates
+make_astar_estimates(const grammar *g, si_t si)
+{
+  astar_estimates e = MALLOC(sizeof(struct astar_estimates));
+  astar_label	  *labels = MALLOC(g->nnts * sizeof(astar_label));
+  size_t	  nrules = g->bpairs[g->nbpairs].start, nunary = 0;
+  size_t	  *ustart, i, k, r, n;
+  astar_uchain	  *up;
+
+  /* coarse labels, numbered in the order of their si_index */
+  e->g = g;
+  e->coarse = MALLOC(g->nnts * sizeof(unsigned));
+  for (i = 0; i < g->nnts; i++) {
+    labels[i].label = project_label(g->id_label[i], si);
+    labels[i].id = i;
+  }
+  qsort(labels, g->nnts, sizeof(astar_label), astar_label_cmp);
+  for (i = 0, n = 0; i < g->nnts; i++) {
+    if (i > 0 && labels[i].label != labels[i-1].label)
+      n++;
+    e->coarse[labels[i].id] = n;
+  }
+  e->ncoarse = g->nnts ? n+1 : 0;
+  FREE(labels);
+
+#define ASTAR_COARSE(x)	((x) < g->nnts ? e->coarse[x] : e->ncoarse + (x) - g->nnts)
+
+  /* binary rules, keeping the best of each coarse rule */
+  e->brules = MALLOC((nrules + 1) * sizeof(astar_brule));
+  for (k = 0, n = 0; k < g->nbpairs; k++)
+    for (r = g->bpairs[k].start; r < g->bpairs[k+1].start; r++, n++) {
+      e->brules[n].parent = e->coarse[g->label_id[g->bparents[r].parent]];
+      e->brules[n].left = ASTAR_COARSE(g->bpair_left[k]);
+      e->brules[n].right = ASTAR_COARSE(g->bpairs[k].right);
+      e->brules[n].prob = g->bparents[r].prob;
+    }
+  qsort(e->brules, nrules, sizeof(astar_brule), astar_brule_cmp);
+  for (r = 0, n = 0; r < nrules; r++)
+    if (n > 0 && !astar_brule_cmp(e->brules + n-1, e->brules + r)) {
+      if (e->brules[r].prob > e->brules[n-1].prob)
+        e->brules[n-1].prob = e->brules[r].prob;
+    }
+    else
+      e->brules[n++] = e->brules[r];
+  e->nbrules = n;
+  e->brules = REALLOC(e->brules, (n + 1) * sizeof(astar_brule));
+#undef ASTAR_COARSE
+
+  /* unary rules between nonterminals, grouped by coarse child */
+  ustart = CALLOC(e->ncoarse + 1, sizeof(size_t));
+  for (i = 0; i < g->nnts; i++)
+    nunary += g->child_urs[i].n;
+  up = MALLOC((nunary + 1) * sizeof(astar_uchain));
+  for (i = 0; i < g->nnts; i++)
+    ustart[e->coarse[i] + 1] += g->child_urs[i].n;
+  for (i = 0; i < e->ncoarse; i++)
+    ustart[i+1] += ustart[i];
+  for (i = 0; i < g->nnts; i++)
+    for (k = 0; k < g->child_urs[i].n; k++) {
+      size_t x = ustart[e->coarse[i]]++;
+      up[x].parent = e->coarse[g->label_id[g->child_urs[i].e[k]->parent]];
+      up[x].prob = g->child_urs[i].e[k]->prob;
+    }
+  for (i = e->ncoarse; i > 0; i--)	/* undo the ++s */
+    ustart[i] = ustart[i-1];
+  ustart[0] = 0;
+  astar_close_unary(e, ustart, up);
+  FREE(ustart);
+  FREE(up);
+  return e;
+}
+
+static void
+free_astar_estimates(astar_estimates e)
+{
+  FREE(e->coarse);
+  FREE(e->brules);
+  FREE(e->uchains_start);
+  FREE(e->uchains);
+  FREE(e);
+}
+
+/* astar_close() applies the coarse unary chains to a row of scores;
+ * going up the chains for inside scores and down them for outside.
+ */
+static void
+astar_close(FLOAT *row, const astar_estimates e, int inside)
+{
+  size_t b, i;
+
+  for (b = 0; b < e->ncoarse; b++)
+    for (i = e->uchains_start[b]; i < e->uchains_start[b+1]; i++) {
+      unsigned a = e->uchains[i].parent;
+      if (inside && row[b] + e->uchains[i].prob > row[a])
+        row[a] = row[b] + e->uchains[i].prob;
+      if (!inside && row[a] + e->uchains[i].prob > row[b])
+        row[b] = row[a] + e->uchains[i].prob;
+    }}
+
+/* astar_outside() returns the coarse outside scores of terms, where
+ * out[ASTAR_SPAN(i, j)*ncoarse + x] is that of coarse label x over
+ * i..j (ASTAR_NONE if it can't be part of a coarse parse), and sets
+ * spanbest[ASTAR_SPAN(i, j)] to the best of them.
+ */
+static FLOAT *
+astar_outside(const astar_estimates e, struct vindex terms, FLOAT *spanbest)
+{
+  const grammar	    *g = e->g;
+  const astar_brule *r, *end = e->brules + e->nbrules;
+  size_t	    nc = e->ncoarse, n = terms.n, size = CHART_SIZE(n) * nc;
+  size_t	    i, k, w, x;
+  FLOAT		    *in = MALLOC(size * sizeof(FLOAT));
+  FLOAT		    *out = MALLOC(size * sizeof(FLOAT));
+  unsigned	    *word = MALLOC(n * sizeof(unsigned));
+
+#define ASTAR_IN(x, i, k)	((x) < nc ? in[ASTAR_SPAN(i, k)*nc + (x)] \
+                                 : (k) == (i)+1 && word[i] == (x) ? 0.0 : ASTAR_NONE)
+
+  for (x = 0; x < size; x++)
+    in[x] = out[x] = ASTAR_NONE;
+
+  /* coarse inside scores, closed up the unary chains */
+  for (i = 0; i < n; i++) {
+    unsigned id = grammar_label_id(g, terms.e[i]);
+    FLOAT    *row = in + ASTAR_SPAN(i, i+1)*nc;
+
+    word[i] = NO_ID;
+    if (id == NO_ID)
+      continue;
+    if (id < g->nnts)
+      row[e->coarse[id]] = 0.0;
+    else
+      word[i] = nc + id - g->nnts;
+    for (k = 0; k < g->child_urs[id].n; k++) {
+      unsigned p = e->coarse[g->label_id[g->child_urs[id].e[k]->parent]];
+      if (g->child_urs[id].e[k]->prob > row[p])
+        row[p] = g->child_urs[id].e[k]->prob;
+    }
+    astar_close(row, e, 1);
+  }
+  for (w = 2; w <= n; w++)
+    for (i = 0; i + w <= n && !PAST_DEADLINE; i++) {
+      FLOAT *row = in + ASTAR_SPAN(i, i+w)*nc;
+      for (k = i+1; k < i+w; k++)
+        for (r = e->brules; r < end; r++) {
+          FLOAT lp = ASTAR_IN(r->left, i, k), rp;
+          if (lp <= ASTAR_NONE) {		/* skip the rest of r's left child */
+            while (r+1 < end && r[1].left == r->left)
+              r++;
+            continue;
+          }
+          rp = ASTAR_IN(r->right, k, i+w);
+          if (rp > ASTAR_NONE && lp + rp + r->prob > row[r->parent])
+            row[r->parent] = lp + rp + r->prob;
+        }
+      astar_close(row, e, 1);
+    }
+
+  /* coarse outside scores, widest spans first */
+  if (n > 0 && g->nnts > 0)
+    out[ASTAR_SPAN(0, n)*nc + e->coarse[0]] = 0.0;
+  for (w = n; w >= 1; w--)
+    for (i = 0; i + w <= n; i++) {
+      FLOAT *row = out + ASTAR_SPAN(i, i+w)*nc, best = ASTAR_NONE;
+      astar_close(row, e, 0);
+      for (x = 0; x < nc; x++)
+        if (row[x] > best)
+          best = row[x];
+      spanbest[ASTAR_SPAN(i, i+w)] = best;
+      if (best <= ASTAR_NONE || PAST_DEADLINE)
+        continue;
+      for (k = i+1; k < i+w; k++)
+        for (r = e->brules; r < end; r++) {
+          FLOAT po = row[r->parent], lp, rp;
+          if (po <= ASTAR_NONE)
+            continue;
+          if (r->left < nc && (rp = ASTAR_IN(r->right, k, i+w)) > ASTAR_NONE
+              && po + r->prob + rp > out[ASTAR_SPAN(i, k)*nc + r->left])
+            out[ASTAR_SPAN(i, k)*nc + r->left] = po + r->prob + rp;
+          if (r->right < nc && (lp = ASTAR_IN(r->left, i, k)) > ASTAR_NONE
+              && po + r->prob + lp > out[ASTAR_SPAN(k, i+w)*nc + r->right])
+            out[ASTAR_SPAN(k, i+w)*nc + r->right] = po + r->prob + lp;
+        }}
+#undef ASTAR_IN
+
+  FREE(in);
+  FREE(word);
+  return out;
+}
+
+
+/* The agenda is a binary heap of edges, best priority first */
+
+typedef struct agenda_item {
+  FLOAT		priority, lprob;
+  unsigned	id;
+  int		left, right;
+  bintree	lchild, rchild;
+} agenda_item;
+
+/* The agenda is indexed by span and label, so a better edge for a
+ * span and label already on the agenda replaces it rather than being
+ * pushed alongside it.  A span's slots are only made when something
+ * is first pushed over it.
+ */
+
+typedef struct agenda_slot {
+  FLOAT		best;		/* best pushed lprob of the span and label */
+  long		pos;		/* its position in e, or -1 if not there */
+} agenda_slot;
+
+typedef struct agenda {
+  agenda_item	*e;
+  size_t	n, nsize;
+  int		nwords;
+  astar_estimates est;
+  FLOAT		*out;		/* coarse outside scores (astar_outside()) */
+  FLOAT		*spanbest;	/* the best of them over each span */
+  FLOAT		bound;		/* priority of the best root pushed */
+  agenda_slot	**slots;	/* slots[ASTAR_SPAN(left, right)][id] */
+} agenda;
+
+#define AGENDA_SLOT(a, it)	((a)->slots[ASTAR_SPAN((it).left, (it).right)] + (it).id)
+
+/* ASTAR_GATE() is true if an edge over left..right with inside score
+ * lprob could still be pushed */
+#define ASTAR_GATE(a, left, right, lprob)			\
+  ((a)->spanbest[ASTAR_SPAN(left, right)] > ASTAR_NONE		\
+   && (lprob) + (a)->spanbest[ASTAR_SPAN(left, right)] >= (a)->bound)
+
+static void
+agenda_put(agenda *a, size_t i, agenda_item it)
+{
+  a->e[i] = it;
+  AGENDA_SLOT(a, it)->pos = i;
+}
+
+static void
+agenda_push(agenda *a, unsigned id, int left, int right, FLOAT lprob,
+            bintree lchild, bintree rchild)
+{
+  size_t      span = ASTAR_SPAN(left, right), i;
+  FLOAT	      h = a->out[span * a->est->ncoarse + a->est->coarse[id]];
+  agenda_slot *slot;
+  agenda_item it;
+
+  if (h <= ASTAR_NONE || lprob + h < a->bound)
+    return;		/* can't be part of a parse better than the root */
+  if (!a->slots[span]) {
+    a->slots[span] = MALLOC(a->est->g->nnts * sizeof(agenda_slot));
+    for (i = 0; i < a->est->g->nnts; i++) {
+      a->slots[span][i].best = ASTAR_NONE;
+      a->slots[span][i].pos = -1;
+    }}
+  slot = a->slots[span] + id;
+  if (lprob <= slot->best)
+    return;		/* never popped before the better edge */
+  slot->best = lprob;
+  it.id = id;
+  it.left = left;
+  it.right = right;
+  it.priority = lprob + h;
+  it.lprob = lprob;
+  it.lchild = lchild;
+  it.rchild = rchild;
+  if (id == 0 && left == 0 && right == a->nwords && it.priority > a->bound)
+    a->bound = it.priority;
+  edges_pushed++;
+  if (slot->pos >= 0)		/* replace the worse edge */
+    i = slot->pos;
+  else {
+    if (a->n >= a->nsize) {
+      a->nsize = a->nsize ? 2*a->nsize : 1024;
+      a->e = REALLOC(a->e, a->nsize * sizeof(agenda_item));
+    }
+    i = a->n++;
+  }
+  for ( ; i > 0 && a->e[(i-1)/2].priority < it.priority; i = (i-1)/2)
+    agenda_put(a, i, a->e[(i-1)/2]);
+  agenda_put(a, i, it);
+}
+
+static agenda_item
+agenda_pop(agenda *a)
+{
+  agenda_item top = a->e[0], last = a->e[--a->n];
+  size_t      i = 0, child;
+
+  AGENDA_SLOT(a, top)->pos = -1;
+  if (a->n == 0)
+    return top;
+  while ((child = 2*i+1) < a->n) {
+    if (child+1 < a->n && a->e[child+1].priority > a->e[child].priority)
+      child++;
+    if (a->e[child].priority <= last.priority)
+      break;
+    agenda_put(a, i, a->e[child]);
+    i = child;
+  }
+  agenda_put(a, i, last);
+  return top;
+}
+
+/* astar_combine() pushes the parents of every pair of cells made of
+ * cl (with id lid, spanning left..mid) and a cell starting at mid with
+ * the pair's right label.
+ */
+static void
+astar_combine_left(agenda *a, chart_cell cl, unsigned lid, int left, int mid,
+                   chart c, const grammar *g)
+{
+  const bpair	*bp, *end = g->bpairs + g->bleft_start[lid+1];
+
+  if (!c->vertex[mid])
+    return;
+  for (bp = g->bpairs + g->bleft_start[lid]; bp < end; bp++) {
+    chart_cell cr;
+    for (cr = centry_id_find(c->vertex[mid], bp->right, g); cr; cr = cr->next) {
+      size_t r;
+      if (!ASTAR_GATE(a, left, cr->rightpos, cl->lprob + cr->lprob))
+        continue;
+      for (r = bp->start; r < bp[1].start; r++)
+        agenda_push(a, g->label_id[g->bparents[r].parent], left, cr->rightpos,
+                    cl->lprob + cr->lprob + g->bparents[r].prob,
+                    &cl->tree, &cr->tree);
+    }}}
+
+/* astar_combine_right() is the mirror image: cr (with id rid, spanning
+ * mid..right) is the right child, and the left children are the
+ * cells ending at mid.
+ */
+static void
+astar_combine_right(agenda *a, chart_cell cr, unsigned rid, int mid, int right,
+                    chart c, const grammar *g)
+{
+  size_t k, r;
+  int	 left;
+
+  for (left = 0; left < mid; left++) {
+    centry e = CHART_ENTRY(c, left, mid);
+
+    if (!e || !ASTAR_GATE(a, left, right, cr->lprob))
+      continue;
+    for (k = g->bright_start[rid]; k < g->bright_start[rid+1]; k++) {
+      const bpair *bp = g->bpairs + g->bright_pairs[k];
+      chart_cell  cl = centry_id_find(e, g->bpair_left[g->bright_pairs[k]], g);
+
+      if (!cl || !ASTAR_GATE(a, left, right, cl->lprob + cr->lprob))
+        continue;
+      for (r = bp->start; r < bp[1].start; r++)
+        agenda_push(a, g->label_id[g->bparents[r].parent], left, right,
+                    cl->lprob + cr->lprob + g->bparents[r].prob,
+                    &cl->tree, &cr->tree);
+    }}}
+
+chart
+astar_parse(struct vindex terms, grammar g, si_t si, coarse_mask mask)
+{
+  chart		c = chart_make(terms.n, mask);
+  agenda	a = {NULL, 0, 0, (int) terms.n, astar_est, NULL, NULL, ASTAR_NONE, NULL};
+  int		left, n = (int) terms.n;
+  size_t	i;
+  long		pops = 0;
+
+  if (mask && !mask->parsed)
+    return c;		/* a prepass found there is no parse */
+  a.spanbest = MALLOC(CHART_SIZE(terms.n) * sizeof(FLOAT));
+  a.out = astar_outside(astar_est, terms, a.spanbest);
+  a.slots = CALLOC(CHART_SIZE(terms.n), sizeof(agenda_slot *));
+
+  /* terminals are in the chart from the start */
+  for (left = 0; left < n; left++) {
+    centry e = chart_span(c, left, left+1, &g);	/* makes vertex[left] */
+    add_edge(e, terms.e[left], NULL, NULL, 0.0, left+1, c->vertex[left], &g);
+  }
+
+  for (left = 0; left < n; left++) {
+    chart_cell cell = CHART_ENTRY(c, left, left+1)->term;
+    unsigned   id = grammar_label_id(&g, terms.e[left]);
+
+    if (id == NO_ID)
+      continue;
+    for (i = 0; i < g.child_urs[id].n; i++)
+      if (TAG_ALLOWED(left, g.child_urs[id].e[i]->parent, &g))
+        agenda_push(&a, g.label_id[g.child_urs[id].e[i]->parent], left, left+1,
+                    g.child_urs[id].e[i]->prob, &cell->tree, NULL);
+    astar_combine_left(&a, cell, id, left, left+1, c, &g);
+  }
+
+  /* the deadline is checked every 1024 pops */
+  while (a.n > 0 && !timed_out && ((++pops & 1023) || !PAST_DEADLINE)) {
+    agenda_item	it = agenda_pop(&a);
+    centry	e = CHART_ENTRY(c, it.left, it.right);
+    chart_cell	cell;
+
+    if (e && BITSET_TEST(e->present, it.id))
+      continue;		/* already popped with a better score */
+    if (c->mask
+        && !BITSET_TEST(COARSE_SPAN_ROW(c->mask, it.left), it.right))
+      continue;
+    e = chart_span(c, it.left, it.right, &g);
+    cell = add_edge(e, g.id_label[it.id], it.lchild, it.rchild, it.lprob,
+                    it.right, c->vertex[it.left], &g);
+    if (!cell)		/* not allowed by the mask */
+      continue;
+    if (it.id == 0 && it.left == 0 && it.right == n)
+      break;		/* the root */
+
+    /* a cell made by a unary chain over a nonterminal needs no closing,
+     * as in apply_unary() */
+    if (!(it.lchild && !it.rchild
+          && grammar_label_id(&g, it.lchild->label) < g.nnts))
+      for (i = g.uchains_start[it.id]; i < g.uchains_start[it.id+1]; i++)
+        agenda_push(&a, g.uchains[i].parent, it.left, it.right,
+                    it.lprob + g.uchains[i].prob, &cell->tree, NULL);
+    astar_combine_left(&a, cell, it.id, it.left, it.right, c, &g);
+    astar_combine_right(&a, cell, it.id, it.left, it.right, c, &g);
+  }
+
+  if (a.e)
+    FREE(a.e);
+  for (i = 0; i < CHART_SIZE(terms.n); i++)
+    if (a.slots[i])
+      FREE(a.slots[i]);
+  FREE(a.slots);
+  FREE(a.out);
+  FREE(a.spanbest);
+  return c;
+}
+
+/* K-best parsing (-N k) prints the k best parses of each sentence,
+ * extracted lazily from the Viterbi chart as in Huang and Chiang's
+ * (2005) algorithm 3.  The chart keeps only the best derivation of
+ * each cell, but its cells are the only ones a derivation can use, so
+ * the hyperedges into a node are enumerated from the chart the first
+ * time the node is visited:
+ *
+ *  the pre node of a label over a span has the binary (or, over a
+ *    word, lexical) rules into that label
+ *  its post node has the pre node of the same label, plus each unary
+ *    rule from the post node of its child, so that derivations that
+ *    differ only in their unary chains are enumerated separately
+ *
+ * Binary rules take post nodes (or words) as children.  Each node
+ * keeps the derivations found so far, best first, and a heap of
+ * candidates; its j'th best derivation is only found when a parent
+ * asks for it.  Unary cycles make the hypergraph cyclic, but every
+ * trip around a cycle costs probability, so a node's j'th derivation
+ * only ever needs the earlier derivations of the nodes on its cycles.
+ *
+ * The Viterbi chart skips the labels inside a chain (see close_cell()),
+ * so a chain may reach a cell through a label a mask kept out of the
+ * chart.  Such a chain is added as a single edge from the pre node at
+ * its bottom, as in apply_unary(), so the nodes' best derivations
+ * still agree with the chart.
+ */
+
+typedef struct kbest_rule {
+  unsigned	left, right;	/* compact ids of the children */
+  FLOAT		prob;
+} kbest_rule;
+
+typedef struct kbest_chain {
+  unsigned	child;		/* compact id of the (bottom) child */
+  FLOAT		prob;
+} kbest_chain;
+
+/* The grammar's binary rules, unary rules between nonterminals (the
+ * best of any duplicates) and unary chains, indexed by parent id
+ */
+
+typedef struct kbest_index {
+  size_t	*rules_start;	/* parent id's rules are ... */
+  kbest_rule	*rules;		/* ... rules[rules_start[id]] ... */
+  size_t	*unary_start;	/* parent id's unary rules are ... */
+  kbest_chain	*unary;		/* ... unary[unary_start[id]] ... */
+  size_t	*chains_start;	/* parent id's chains are ... */
+  kbest_chain	*chains;	/* ... chains[chains_start[id]] ... */
+} *kbest_index;
+
+kbest_index	kbest_ix = NULL;
+
+/* kb_urule_kept() is false if urs, a child's unary (or lexical) rules,
+ * has a better copy of rule r, or an equally good one before it.  The
+ * grammar keeps duplicate unary rules apart, and only the best copy
+ * can be in a Viterbi derivation, so the others would only repeat its
+ * trees with worse scores.
+ */
+static int
+kb_urule_kept(urules urs, size_t r)
+{
+  size_t i;
+
+  for (i = 0; i < urs.n; i++)
+    if (i != r && urs.e[i]->parent == urs.e[r]->parent
+        && (urs.e[i]->prob > urs.e[r]->prob
+            || (urs.e[i]->prob == urs.e[r]->prob && i < r)))
+      return 0;
+  return 1;
+}
+
+static kbest_index
+make_kbest_index(const grammar *g)
+{
+  kbest_index ix = MALLOC(sizeof(struct kbest_index));
+  size_t      nrules = g->bpairs[g->nbpairs].start;
+  size_t      nchains = g->uchains_start[g->nnts], nunary = 0, id, k, r;
+
+  for (id = 0; id < g->nnts; id++)
+    nunary += g->child_urs[id].n;
+  ix->rules_start = CALLOC(g->nnts + 1, sizeof(size_t));
+  ix->rules = MALLOC((nrules + 1) * sizeof(kbest_rule));
+  ix->unary_start = CALLOC(g->nnts + 1, sizeof(size_t));
+  ix->unary = MALLOC((nunary + 1) * sizeof(kbest_chain));
+  ix->chains_start = CALLOC(g->nnts + 1, sizeof(size_t));
+  ix->chains = MALLOC((nchains + 1) * sizeof(kbest_chain));
+
+  /* count, then place each rule at its parent's end */
+  for (r = 0; r < nrules; r++)
+    ix->rules_start[g->label_id[g->bparents[r].parent] + 1]++;
+  for (id = 0; id < g->nnts; id++)
+    for (r = 0; r < g->child_urs[id].n; r++)
+      if (kb_urule_kept(g->child_urs[id], r))
+        ix->unary_start[g->label_id[g->child_urs[id].e[r]->parent] + 1]++;
+  for (r = 0; r < nchains; r++)
+    ix->chains_start[g->uchains[r].parent + 1]++;
+  for (id = 0; id < g->nnts; id++) {
+    ix->rules_start[id+1] += ix->rules_start[id];
+    ix->unary_start[id+1] += ix->unary_start[id];
+    ix->chains_start[id+1] += ix->chains_start[id];
+  }
+  for (k = 0; k < g->nbpairs; k++)
+    for (r = g->bpairs[k].start; r < g->bpairs[k+1].start; r++) {
+      kbest_rule *rule = 
+        &ix->rules[ix->rules_start[g->label_id[g->bparents[r].parent]]++];
+      rule->left = g->bpair_left[k];
+      rule->right = g->bpairs[k].right;
+      rule->prob = g->bparents[r].prob;
+    }
+  for (id = 0; id < g->nnts; id++)
+    for (r = 0; r < g->child_urs[id].n; r++) {
+      urule	  rule = g->child_urs[id].e[r];
+      kbest_chain *unary;
+
+      if (!kb_urule_kept(g->child_urs[id], r))
+        continue;
+      unary = &ix->unary[ix->unary_start[g->label_id[rule->parent]]++];
+      unary->child = id;
+      unary->prob = rule->prob;
+    }
+  for (id = 0; id < g->nnts; id++)
+    for (r = g->uchains_start[id]; r < g->uchains_start[id+1]; r++) {
+      kbest_chain *chain = &ix->chains[ix->chains_start[g->uchains[r].parent]++];
+      chain->child = id;
+      chain->prob = g->uchains[r].prob;
+    }
+  /* placing moved each start to the next parent's start */
+  for (id = g->nnts; id > 0; id--) {
+    ix->rules_start[id] = ix->rules_start[id-1];
+    ix->unary_start[id] = ix->unary_start[id-1];
+    ix->chains_start[id] = ix->chains_start[id-1];
+  }
+  ix->rules_start[0] = ix->unary_start[0] = ix->chains_start[0] = 0;
+  return ix;
+}
+
+static void
+free_kbest_index(kbest_index ix)
+{
+  FREE(ix->rules_start);
+  FREE(ix->rules);
+  FREE(ix->unary_start);
+  FREE(ix->unary);
+  FREE(ix->chains_start);
+  FREE(ix->chains);
+  FREE(ix);
+}
+
+/* Nodes, edges and derivations live in chart memory, so they are freed
+ * along with the chart.
+ */
+
+typedef struct kb_node *kb_node;
+
+typedef struct kb_edge {
+  kb_node	left, right;	/* tails; right is NULL for unary edges */
+  FLOAT		prob;
+} kb_edge;
+
+typedef struct kb_deriv {
+  const kb_edge	*e;
+  unsigned	i, j;		/* ranks of the derivations of e's tails */
+  FLOAT		lprob;
+} kb_deriv;
+
+struct kb_node {
+  unsigned	id;
+  int		left, right;	/* the node's span */
+  int		pre;		/* 1 for a pre node or word, 0 for post */
+  int		visited;	/* non-zero once e has been filled in */
+  kb_edge	*e;		/* incoming edges */
+  size_t	ne, esize;
+  kb_deriv	*d;		/* the derivations found so far, best first */
+  size_t	nd, dsize;
+  kb_deriv	*cand;		/* heap of candidate derivations */
+  size_t	ncand, csize;
+};
+
+typedef struct kbest_chart {
+  chart		c;
+  const grammar	*g;
+  kb_node	**nodes;	/* nodes[span][2*id+pre], made on demand */
+  kb_node	*words;		/* words[i] is the node of word i */
+} kbest_chart;
+
+#define KB_NODES(kc, i, j)	(kc)->nodes[(j)*((j)-1)/2+(i)]
+
+/* kb_grow() returns the chart-memory array p, which holds n elements
+ * of size elsize and has room for *size, with room for one more.
+ */
+static void *
+kb_grow(void *p, size_t n, size_t *size, size_t elsize)
+{
+  void *q;
+
+  if (n < *size)
+    return p;
+  *size = *size ? 2 * *size : 4;
+  q = MALLOC_CHART(*size * elsize);
+  if (n)
+    memcpy(q, p, n * elsize);
+  return q;
+}
+
+static kb_node
+make_kb_node(unsigned id, int left, int right, int pre)
+{
+  kb_node v = MALLOC_CHART(sizeof(struct kb_node));
+
+  memset(v, 0, sizeof(struct kb_node));
+  v->id = id;
+  v->left = left;
+  v->right = right;
+  v->pre = pre;
+  return v;
+}
+
+/* kb_node_ref() returns the node for id over left..right, or NULL if
+ * there is no derivation of that kind.  A post node needs a cell in
+ * the chart, and a pre node a binary or lexical edge (whose cell may
+ * since have been pruned).
+ */
+static kb_node
+kb_node_ref(kbest_chart *kc, int left, int right, unsigned id, int pre)
+{
+  centry  e = CHART_ENTRY(kc->c, left, right);
+  kb_node *np;
+
+  if (!e)
+    return NULL;
+  if (id >= kc->g->nnts)
+    return right == left+1 && e->term 
+      && e->term->tree.label == kc->g->id_label[id] ? kc->words[left] : NULL;
+  if (pre ? e->pre_lprob[id] <= PRE_NONE : !centry_id_find(e, id, kc->g))
+    return NULL;
+  if (!KB_NODES(kc, left, right)) {
+    size_t size = 2 * kc->g->nnts * sizeof(kb_node);
+    KB_NODES(kc, left, right) = MALLOC_CHART(size);
+    memset(KB_NODES(kc, left, right), 0, size);
+  }
+  np = &KB_NODES(kc, left, right)[2*id+pre];
+  if (!*np)
+    *np = make_kb_node(id, left, right, pre);
+  return *np;
+}
+
+static void
+kb_add_edge(kb_node v, kb_node left, kb_node right, FLOAT prob)
+{
+  v->e = kb_grow(v->e, v->ne, &v->esize, sizeof(kb_edge));
+  v->e[v->ne].left = left;
+  v->e[v->ne].right = right;
+  v->e[v->ne++].prob = prob;
+}
+
+static const kb_deriv *kb_kth(kbest_chart *kc, kb_node v, size_t k);
+
+/* kb_best() returns the lprob of v's best derivation, which the chart
+ * already knows.
+ */
+static FLOAT
+kb_best(kbest_chart *kc, kb_node v)
+{
+  centry e;
+
+  if (v->id >= kc->g->nnts)	/* a word */
+    return 0.0;
+  e = CHART_ENTRY(kc->c, v->left, v->right);
+  return v->pre ? e->pre_lprob[v->id] : centry_id_ref(e, v->id, kc->g)->lprob;
+}
+
+/* The candidate heap, best first */
+
+static void
+kb_push(kb_node v, kb_deriv d)
+{
+  size_t i;
+
+  v->cand = kb_grow(v->cand, v->ncand, &v->csize, sizeof(kb_deriv));
+  for (i = v->ncand++; i > 0 && v->cand[(i-1)/2].lprob < d.lprob; i = (i-1)/2)
+    v->cand[i] = v->cand[(i-1)/2];
+  v->cand[i] = d;
+}
+
+static kb_deriv
+kb_pop(kb_node v)
+{
+  kb_deriv top = v->cand[0], last = v->cand[--v->ncand];
+  size_t   i = 0, child;
+
+  while ((child = 2*i+1) < v->ncand) {
+    if (child+1 < v->ncand && v->cand[child+1].lprob > v->cand[child].lprob)
+      child++;
+    if (v->cand[child].lprob <= last.lprob)
+      break;
+    v->cand[i] = v->cand[child];
+    i = child;
+  }
+  v->cand[i] = last;
+  return top;
+}
+
+/* kb_chain_in_chart() returns 1 if every label strictly inside the
+ * best unary chain from child up to ancestor has a cell in e
+ */
+static int
+kb_chain_in_chart(kbest_chart *kc, centry e, unsigned child, unsigned ancestor)
+{
+  const grammar	*g = kc->g;
+  si_index	below = g->id_label[ancestor];
+
+  while ((below = unary_below(g, g->id_label[child], below)) 
+         != g->id_label[child])
+    if (!centry_id_find(e, g->label_id[below], g))
+      return 0;
+  return 1;
+}
+
+/* kb_edges() enumerates the edges into v from the chart */
+static void
+kb_edges(kbest_chart *kc, kb_node v)
+{
+  const grammar	*g = kc->g;
+  size_t	r;
+  int		mid;
+
+  if (!v->pre) {
+    kb_node pre = kb_node_ref(kc, v->left, v->right, v->id, 1);
+
+    kb_node post;
+    centry  e = CHART_ENTRY(kc->c, v->left, v->right);
+
+    if (pre)
+      kb_add_edge(v, pre, NULL, 0.0);
+    for (r = kbest_ix->unary_start[v->id]; 
+         r < kbest_ix->unary_start[v->id+1]; r++)
+      if ((post = kb_node_ref(kc, v->left, v->right, 
+                              kbest_ix->unary[r].child, 0)))
+        kb_add_edge(v, post, NULL, kbest_ix->unary[r].prob);
+    for (r = kbest_ix->chains_start[v->id]; 
+         r < kbest_ix->chains_start[v->id+1]; r++)
+      if ((pre = kb_node_ref(kc, v->left, v->right, 
+                             kbest_ix->chains[r].child, 1))
+          && !kb_chain_in_chart(kc, e, kbest_ix->chains[r].child, v->id))
+        kb_add_edge(v, pre, NULL, kbest_ix->chains[r].prob);
+  }
+  else if (v->right == v->left+1) {	/* lexical rules */
+    unsigned t = kc->words[v->left]->id;
+    urules   urs;
+
+    if (t == NO_ID)	/* an unknown word */
+      return;
+    urs = g->child_urs[t];
+    for (r = 0; r < urs.n; r++)
+      if (g->label_id[urs.e[r]->parent] == v->id && kb_urule_kept(urs, r))
+        kb_add_edge(v, kc->words[v->left], NULL, urs.e[r]->prob);
+  }
+  else
+    for (mid = v->left+1; mid < v->right; mid++) {
+      if (!CHART_ENTRY(kc->c, v->left, mid) || !CHART_ENTRY(kc->c, mid, v->right))
+        continue;
+      for (r = kbest_ix->rules_start[v->id]; 
+           r < kbest_ix->rules_start[v->id+1]; r++) {
+        const kbest_rule *rule = &kbest_ix->rules[r];
+        kb_node	l = kb_node_ref(kc, v->left, mid, rule->left, 0), rt;
+
+        if (l && (rt = kb_node_ref(kc, mid, v->right, rule->right, 0)))
+          kb_add_edge(v, l, rt, rule->prob);
+      }}
+}
+
+/* kb_tail_lprob() sets *lprob to the lprob of tail's k'th best
+ * derivation and returns 1, or returns 0 if there is none.  Best
+ * derivations are scored from the chart, so the tail need not have
+ * been visited.
+ */
+static int
+kb_tail_lprob(kbest_chart *kc, kb_node tail, size_t k, FLOAT *lprob)
+{
+  const kb_deriv *d;
+
+  if (!tail)
+    *lprob = 0.0;
+  else if (k == 0)
+    *lprob = kb_best(kc, tail);
+  else if ((d = kb_kth(kc, tail, k)))
+    *lprob = d->lprob;
+  else
+    return 0;
+  return 1;
+}
+
+/* kb_candidate() pushes the derivation of v using e with its tails'
+ * i'th and j'th best derivations, if they exist.
+ */
+static void
+kb_candidate(kbest_chart *kc, kb_node v, const kb_edge *e, 
+             unsigned i, unsigned j)
+{
+  FLOAT	   l, r;
+  kb_deriv d;
+
+  if (!kb_tail_lprob(kc, e->left, i, &l) || !kb_tail_lprob(kc, e->right, j, &r))
+    return;
+  d.e = e;
+  d.i = i;
+  d.j = j;
+  d.lprob = e->prob + l + r;
+  kb_push(v, d);
+}
+
+/* kb_kth() returns v's k'th best derivation (counting from 0), or NULL
+ * if it has fewer than k+1.  The successors of a derivation (i, j) are
+ * (i+1, j) if j is 0 and (i, j+1), so each is pushed exactly once.
+ */
+static const kb_deriv *
+kb_kth(kbest_chart *kc, kb_node v, size_t k)
+{
+  size_t i;
+
+  if (!v->visited) {
+    v->visited = 1;
+    if (v->id < kc->g->nnts)
+      kb_edges(kc, v);
+    else
+      kb_add_edge(v, NULL, NULL, 0.0);	/* a word */
+    for (i = 0; i < v->ne; i++)
+      kb_candidate(kc, v, &v->e[i], 0, 0);
+  }
+  while (v->nd <= k) {
+    if (v->nd > 0) {
+      kb_deriv last = v->d[v->nd-1];
+
+      if (last.e->left && last.j == 0)
+        kb_candidate(kc, v, last.e, last.i+1, 0);
+      if (last.e->right)
+        kb_candidate(kc, v, last.e, last.i, last.j+1);
+    }
+    if (v->ncand == 0)
+      return NULL;
+    v->d = kb_grow(v->d, v->nd, &v->dsize, sizeof(kb_deriv));
+    v->d[v->nd++] = kb_pop(v);
+  }
+  return &v->d[k];
+}
+
+/* kb_tree() returns the tree of v's k'th best derivation, which must
+ * exist, with every unary rule as its own node.
+ */
+static bintree
+kb_tree(kbest_chart *kc, kb_node v, size_t k)
+{
+  const kb_deriv *d = kb_kth(kc, v, k);
+  bintree	 t, u;
+  si_index	 child, below;
+
+  if (!v->pre && d->e->left->pre) {
+    if (d->e->left->id == v->id)	/* the pre node itself */
+      return kb_tree(kc, d->e->left, d->i);
+    /* a chain the chart skipped: fill in its labels from the top */
+    child = kc->g->id_label[d->e->left->id];
+    t = u = NEW_BINTREE;
+    u->label = kc->g->id_label[v->id];
+    u->right = NULL;
+    while ((below = unary_below(kc->g, child, u->label)) != child) {
+      u = u->left = NEW_BINTREE;
+      u->label = below;
+      u->right = NULL;
+    }
+    u->left = kb_tree(kc, d->e->left, d->i);
+    return t;
+  }
+  t = NEW_BINTREE;
+  t->label = kc->g->id_label[v->id];
+  t->left = d->e->left ? kb_tree(kc, d->e->left, d->i) : NULL;
+  t->right = d->e->right ? kb_tree(kc, d->e->right, d->j) : NULL;
+  return t;
+}
+
+/* write_kbest() writes the nbest best parses in c, one per line, and
+ * returns the number written.
+ */
+static int
+write_kbest(FILE *fp, chart c, const struct vindex *terms, int nbest,
+            const grammar *g, si_t si)
+{
+  kbest_chart	kc;
+  kb_node	root;
+  int		i, k;
+
+  kc.c = c;
+  kc.g = g;
+  kc.nodes = MALLOC_CHART(CHART_SIZE(terms->n) * sizeof(kb_node *));
+  memset(kc.nodes, 0, CHART_SIZE(terms->n) * sizeof(kb_node *));
+  kc.words = MALLOC_CHART(terms->n * sizeof(kb_node));
+  for (i = 0; i < (int) terms->n; i++)
+    kc.words[i] = make_kb_node(grammar_label_id(g, terms->e[i]), i, i+1, 1);
+
+  root = kb_node_ref(&kc, 0, terms->n, grammar_label_id(g, g->root_label), 0);
+  for (k = 0; root && k < nbest && kb_kth(&kc, root, k); k++) {
+    bintree t = kb_tree(&kc, root, k);
+    tree    parse_tree = bintree_tree(t, si);
+
+    fprintf(fp, "%f\t", (double) root->d[k].lprob);
+    write_tree(fp, parse_tree, si);
+    fprintf(fp, "\n");
+    free_tree(parse_tree);
+    free_bintree(t);
+  }
+  return k;
+}
+
+static vindex
+read_terms(FILE *fp, si_t si)
+{
+  size_t i = 0, nsize = 10;
+  vindex v = make_vindex(nsize);
+  si_index term;
+
+  while ((term = read_cat_term(fp, si))) {
+    if (i >= nsize) {
+      nsize *= 2;
+      vindex_resize(v, nsize);
+    }
+    assert(i < nsize);
+    vindex_ref(v,i++) = term;
+  }
+ 
+  if (i > 0) {
+    v->n = i;
+    vindex_resize(v, v->n);
+    return (v);
+  }
+  else {
+    vindex_free(v);
+    return(NULL);
+  }
+}
+
+char	glue[] = {'G', 'L', 'U', 'E', BINSEP, '\0'};	/* glue nodes' label */
+
+/* With -W, a sentence with no root over all of it (because it's
+ * longer than the width, or has no parse) gets a glue parse: a root
+ * over the fewest subtrees that cover the sentence, each the best
+ * unbinarized category in its span, and the most probable of those.
+ * The glue root's log prob is the sum of its children's.
+ */
+static chart_cell
+chart_glue(chart c, const grammar *g, si_t si)
+{
+  size_t	n = c->n, i, j, id;
+  int		*nsub = MALLOC((n+1) * sizeof(int));
+  size_t	*back = MALLOC((n+1) * sizeof(size_t));
+  FLOAT		*score = MALLOC((n+1) * sizeof(FLOAT));
+  chart_cell	*sub = MALLOC((n+1) * sizeof(chart_cell)), root = NULL, tail;
+  bitword	*whole = CALLOC(BITSET_WORDS(g->nnts), sizeof(bitword));
+
+  for (id = 0; id < g->nnts; id++)
+    if (!strchr(si_index_string(si, g->id_label[id]), BINSEP))
+      BITSET_SET(whole, id);
+
+  nsub[0] = 0;
+  score[0] = 0;
+  for (j = 1; j <= n; j++) {
+    nsub[j] = INT_MAX;
+    for (i = c->w && j > c->w ? j - c->w : 0; i < j; i++) {
+      centry	 e = CHART_ENTRY(c, i, j);
+      chart_cell best = NULL, cell;
+
+      if (nsub[i] == INT_MAX || !e)
+        continue;
+      for (id = bitset_next_and(e->present, whole, 0, g->nnts); id < g->nnts;
+           id = bitset_next_and(e->present, whole, id+1, g->nnts)) {
+        cell = centry_id_ref(e, id, g);
+        if (!best || cell->lprob > best->lprob)
+          best = cell;
+      }
+      if (best && (nsub[i] + 1 < nsub[j] || (nsub[i] + 1 == nsub[j] 
+                                             && score[i] + best->lprob > score[j]))) {
+        nsub[j] = nsub[i] + 1;
+        score[j] = score[i] + best->lprob;
+        back[j] = i;
+        sub[j] = best;
+      }}}
+
+  if (nsub[n] < INT_MAX) {	/* glue the subtrees together right to left */
+    si_index glue_label = si_string_index(si, glue);
+
+    tail = make_chart_cell(glue_label, NULL, NULL, 0.0, n, NULL);
+    for (j = n; back[j] > 0; j = back[j])
+      tail = make_chart_cell(glue_label, &sub[j]->tree, &tail->tree, 0.0, n, NULL);
+    root = make_chart_cell(g->root_label, &sub[j]->tree, &tail->tree, 
+                           score[n], n, NULL);
+  }
+  FREE(nsub);
+  FREE(back);
+  FREE(score);
+  FREE(sub);
+  FREE(whole);
+  return root;
+}
+
+/* chart_root() returns the root cell over all of c, or its glue parse
+ * with -W, or NULL if there is neither.
+ */
+static chart_cell
+chart_root(chart c, const grammar *g, si_t si)
+{
+  chart_cell root = CHART_IN_BAND(c, 0, c->n) && CHART_ENTRY(c, 0, c->n) ?
+    centry_ref(CHART_ENTRY(c, 0, c->n), g->root_label, g) : NULL;
+
+  if (!root && max_span_width > 0 && c->n > 0)
+    root = chart_glue(c, g, si);
+  return root;
+}
+
+/* read_lattice() reads the arcs of the next lattice in fp, which has
+ * a line "from to word lprob" for each word arc and "from to tag word
+ * lprob" for each tag arc, and a blank line after each lattice.  It
+ * returns a vector of placeholder terms, one for each step from state
+ * 0 to the highest state, or NULL at the end of the file.
+ */
+static vindex
+read_lattice(FILE *fp, si_t si)
+{
+  char		*line = NULL, word[MAXLABELLEN], tag[MAXLABELLEN];
+  char		label[MAXLABELLEN+2], *end;
+  size_t	linesize = 0, i;
+  int		n = 0, from, to, nfields;
+  double	lprob;
+  vindex	v;
+
+  lattice_narcs = 0;
+  while (getline(&line, &linesize, fp) >= 0) {
+    if (line[strspn(line, " \t\n")] == '\0') {
+      if (lattice_narcs > 0)
+        break;		/* the blank line after a lattice */
+      continue;
+    }
+    nfields = strlen(line) < MAXLABELLEN ? 
+      sscanf(line, "%d %d %s %s %lg", &from, &to, tag, word, &lprob) : 0;
+    if (nfields == 4) {		/* a word arc, so word[] is its lprob */
+      lprob = strtod(word, &end);
+      if (*end)
+        nfields = 0;
+    }
+    if ((nfields != 4 && nfields != 5) || from < 0 || from >= to) {
+      fprintf(stderr, "Sentence %d: ignoring lattice arc %s", 
+              sentenceno+1, line);
+      continue;
+    }
+    if (lattice_narcs >= lattice_nsize) {
+      lattice_nsize = lattice_nsize ? 2*lattice_nsize : 64;
+      lattice = REALLOC(lattice, lattice_nsize * sizeof(lattice_arc));
+    }
+    lattice[lattice_narcs].from = from;
+    lattice[lattice_narcs].to = to;
+    lattice[lattice_narcs].lprob = lprob;
+    if (nfields == 4) {		/* tag[] is the word */
+      sprintf(label, "_%s_", tag);
+      lattice[lattice_narcs].tag = 0;
+    }
+    else {
+      sprintf(label, "_%s_", word);
+      lattice[lattice_narcs].tag = si_string_index(si, tag);
+    }
+    lattice[lattice_narcs].word = si_string_index(si, label);
+    lattice_narcs++;
+    if (to > n)
+      n = to;
+  }
+  free(line);			/* allocated by getline() */
+
+  if (lattice_narcs == 0)
+    return NULL;
+  v = make_vindex(n);
+  v->n = n;
+  for (i = 0; i < v->n; i++)
+    vindex_ref(v, i) = 0;
+  return v;
+}
+
+/* chart_root_lprob() sets *lprob to the root's score in c and returns
+ * non-zero, or returns 0 if c has no parse */
+static int
+chart_root_lprob(chart c, size_t n, const grammar *g, FLOAT *lprob)
+{
+  chart_cell root = CHART_ENTRY(c, 0, n) ?
+    centry_ref(CHART_ENTRY(c, 0, n), g->root_label, g) : NULL;
+
+  if (root)
+    *lprob = root->lprob;
+  return root != NULL;
+}
+
+/* Semiring mode (-S semiring) prints just the value of the root over
+ * each sentence, computed by one of the parsers in semiring.h, or
+ * -inf (or 0) if there is no parse.
+ */
+#define SEMIRING_NONE		0
+#define SEMIRING_VITERBI	1
+#define SEMIRING_INSIDE		2
+#define SEMIRING_PROB		3
+#define SEMIRING_COUNT		4
+#define SEMIRING_RECOGNIZE	5
+
+int		semiring = SEMIRING_NONE;
+viterbi_cky_grammar	viterbi_grammar = NULL;
+inside_cky_grammar	inside_grammar = NULL;
+prob_cky_grammar	prob_grammar = NULL;
+count_cky_grammar	count_grammar = NULL;
+recognize_cky_grammar	recognize_grammar = NULL;
+
+static void
+make_semiring_grammar(const grammar *g)
+{
+  switch (semiring) {
+  case SEMIRING_VITERBI: viterbi_grammar = make_viterbi_cky_grammar(g); break;
+  case SEMIRING_INSIDE: inside_grammar = make_inside_cky_grammar(g); break;
+  case SEMIRING_PROB: prob_grammar = make_prob_cky_grammar(g); break;
+  case SEMIRING_COUNT: count_grammar = make_count_cky_grammar(g); break;
+  case SEMIRING_RECOGNIZE: recognize_grammar = make_recognize_cky_grammar(g); break;
+  }
+}
+
+static void
+free_semiring_grammar(void)
+{
+  switch (semiring) {
+  case SEMIRING_VITERBI: free_viterbi_cky_grammar(viterbi_grammar); break;
+  case SEMIRING_INSIDE: free_inside_cky_grammar(inside_grammar); break;
+  case SEMIRING_PROB: free_prob_cky_grammar(prob_grammar); break;
+  case SEMIRING_COUNT: free_count_cky_grammar(count_grammar); break;
+  case SEMIRING_RECOGNIZE: free_recognize_cky_grammar(recognize_grammar); break;
+  }
+}
+
+static void
+write_semiring_value(FILE *fp, const struct vindex *terms, int too_long)
+{
+  FLOAT lprob;
+
+  switch (semiring) {
+  case SEMIRING_VITERBI:
+  case SEMIRING_INSIDE:
+    lprob = too_long ? LOG_ZERO : semiring == SEMIRING_VITERBI ?
+      viterbi_cky(viterbi_grammar, terms) : inside_cky(inside_grammar, terms);
+    if (lprob > LOG_ZERO)
+      fprintf(fp, "%f\n", (double) lprob);
+    else
+      fprintf(fp, "-inf\n");
+    break;
+  case SEMIRING_PROB:
+    fprintf(fp, "%g\n", too_long ? 0.0 : prob_cky(prob_grammar, terms));
+    break;
+  case SEMIRING_COUNT:
+    fprintf(fp, "%.17g\n", too_long ? 0.0 : count_cky(count_grammar, terms));
+    break;
+  case SEMIRING_RECOGNIZE:
+    fprintf(fp, "%d\n", too_long ? 0 : recognize_cky(recognize_grammar, terms));
+    break;
+  }
+}
+
+/* Posterior mode (-P threshold) prints, instead of the Viterbi parse,
+ * the log prob of each sentence summed over its parses, followed by
+ * every (span, label) pair with posterior at least threshold, one per
+ * line as "left right label posterior", and an empty line.
+ */
+inout_grammar	posterior_grammar = NULL;
+double		posterior_threshold = 0;
+
+static void
+write_posteriors(FILE *fp, const struct vindex *terms, int too_long, si_t si)
+{
+  const grammar	*g = posterior_grammar->g;
+  posteriors	p;
+  size_t	i, k, id;
+
+  if (too_long) {
+    fprintf(fp, "-inf\n\n");
+    return;
+  }
+  p = inside_outside(posterior_grammar, terms);
+  if (p->lprob > LOG_ZERO) {
+    fprintf(fp, "%f\n", (double) p->lprob);
+    for (i = 0; i < terms->n; i++)
+      for (k = i+1; k <= terms->n; k++) {
+        FLOAT *post = POSTERIORS(p, i, k);
+        for (id = 0; id < g->nnts; id++)
+          if (post[id] > 0 && post[id] >= posterior_threshold)
+            fprintf(fp, "%lu\t%lu\t%s\t%g\n", (unsigned long) i,
+                    (unsigned long) k, si_index_string(si, g->id_label[id]),
+                    (double) post[id]);
+      }}
+  else
+    fprintf(fp, "-inf\n");
+  fprintf(fp, "\n");
+  free_posteriors(p);
+}
+
+/* Surprisal mode (-s) prints, instead of the Viterbi parse, each word
+ * of a sentence and its surprisal in bits, i.e. -log2 of its
+ * probability given the words before it, computed from prefix
+ * probabilities in one left-to-right pass (see prefix.h), and then an
+ * empty line.  A word no sentence could continue with has surprisal
+ * inf, as do the words after it.
+ */
+prefix_grammar	surprisal_grammar = NULL;
+int		surprisal = 0;
+
+static void
+write_surprisals(FILE *fp, const struct vindex *terms, int too_long, si_t si)
+{
+  prefix_chart	pc;
+  FLOAT		lprob = 0, prev;
+  size_t	i;
+
+  if (!too_long) {
+    pc = make_prefix_chart(surprisal_grammar);
+    for (i = 0; i < terms->n; i++) {
+      prev = lprob;
+      lprob = prefix_word(pc, terms->e[i]);
+      if (lprob > LOG_ZERO)
+        fprintf(fp, "%s\t%g\n", si_index_string(si, terms->e[i]),
+                (double) ((prev - lprob) / log(2.0)));
+      else
+        fprintf(fp, "%s\tinf\n", si_index_string(si, terms->e[i]));
+    }
+    free_prefix_chart(pc);
+  }
+  fprintf(fp, "\n");
+}
+
+/* Each sentence is a job for parse_sentence(), which writes its parse
+ * to out and its log lines to log, and leaves its statistics for
+ * finish_job() to add up.  With -j N, the main thread reads a batch of
+ * sentences, N threads parse them, each taking the next sentence that
+ * no thread has taken yet and writing to memory, and the main thread
+ * writes each sentence's output as soon as it and those before it are
+ * done, so the output is in order.  The grammar and the other tables
+ * are shared and read-only; the chart arena (see ncky-helper.c), the
+ * sentence number and the statistics are thread-local.  Nothing is read
+ * while a batch is parsed, so the threads can look labels up in si
+ * (but mustn't add to it).
+ */
+typedef struct job {
+  int		sentenceno;
+  vindex	terms;
+  int		too_long;
+  chart		c;		/* -I: the chart parse_word() built */
+  coarse_mask	spans;		/* -B: its span constraints */
+  bitword	*tag_sets;	/* -T, -D: its allowed preterminals */
+  FILE		*out, *log;
+  char		*outbuf, *logbuf;	/* -j: out's and log's contents */
+  size_t	outsize, logsize;
+  int		parsed, compared, changed;
+  double	lprob;
+  int		prepass_failed, coarse_fallback, constraint_failed;
+  int		taken, done;
+  double	cost;		/* -j: its estimated parsing time */
+  int		kbest;		/* -N: the number of parses to write */
+} job;
+
+#define JOBS_PER_THREAD	32	/* sentences per thread read ahead */
+
+/* With -j the reader interns the words of the sentences it reads
+ * ahead while the parsing threads look labels up to write their
+ * parses, so each holds si_lock while it uses si, the reader for
+ * writing.
+ */
+pthread_rwlock_t si_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int	nthreads = 1;		/* -j N */
+int	compare_exhaustive = 0;	/* -x */
+FILE	*probfp = NULL;		/* max_neglog_prob */
+
+int	parsed_sentences = 0, failed_sentences = 0;
+int	compared_sentences = 0, changed_sentences = 0;
+double	sum_neglog_prob = 0;
+
+static void
+parse_sentence(job *j, const grammar *gp, si_t si)
+{
+  grammar	g = *gp;
+  vindex	terms = j->terms;
+  chart		c;
+  chart_cell	root_cell;
+
+  sentenceno = j->sentenceno;
+  tag_sets = j->tag_sets;
+  edges_proposed = 0;
+  cells_probed = 0;
+  edges_pruned = 0;
+  edges_pushed = 0;
+
+  if (j->too_long) {
+    if (j->c)
+      chart_free(j->c, j->c->n);
+    if (j->out) {
+      fprintf(j->out, kbest ? "-inf\t(TOP)\n\n" : "-inf\t(TOP)\n");
+    }
+    return;
+  }
+
+
+  /* size_t	i; */
+  /* if (j->log) { */
+  /*   fprintf(j->log, "Sentence %d:", sentenceno); */
+  /*   for (i=0; i<terms->n; i++) */
+  /*     fprintf(j->log, " %s", si_index_string(si, terms->e[i])); */
+  /*   fprintf(j->log, "\n"); */
+  /* } */
+
+  int    parsed;
+  FLOAT  pruned_lprob, exhaustive_lprob = 0.0;
+  time_t start_time = time(0);
+  coarse_mask spans = j->spans;
+  coarse_mask live = prepass ? recognize(prepass, terms) : NULL;
+  coarse_mask mask;
+
+  if (live && !live->parsed && !timed_out)
+    j->prepass_failed = 1;
+  if (spans && live)
+    coarse_mask_and(live, spans);
+  else if (spans)
+    live = spans;
+  mask = live;
+  if (coarse_grammar && (!live || live->parsed)) {
+    mask = coarse_prune(coarse_grammar, terms);
+    if (live)
+      coarse_mask_and(mask, live);
+  }
+ 
+  grammar sg = restrict_grammar ? sentence_grammar(&g, terms->e, terms->n) : g;
+
+  /* with -I it's parsed already */
+  c = j->c ? j->c : (astar ? astar_parse : cky)(*terms, sg, si, mask);
+
+  /* fetch best root node */
+
+  pthread_rwlock_rdlock(&si_lock);
+  root_cell = timed_out ? NULL : chart_root(c, &g, si);	/* half built */
+  pthread_rwlock_unlock(&si_lock);
+
+  if (!root_cell && mask && mask->parsed && mask != live && !timed_out) {
+    /* the coarse parse pruned every fine parse, so parse again
+     * without it */
+    j->coarse_fallback = 1;
+    if (j->log)
+      fprintf(j->log, "%d: coarse pruning failed, reparsing\n", sentenceno);
+    chart_free(c, terms->n);
+    c = (astar ? astar_parse : cky)(*terms, sg, si, live);
+    pthread_rwlock_rdlock(&si_lock);
+    root_cell = timed_out ? NULL : chart_root(c, &g, si);
+    pthread_rwlock_unlock(&si_lock);
+  }
+
+  time_t run_time = time(0) - start_time;
+  parsed = j->parsed = root_cell != NULL;
+  pruned_lprob = parsed ? root_cell->lprob : 0.0;
+
+  pthread_rwlock_rdlock(&si_lock);	/* the output looks up labels */
+  if (root_cell) {
+    bintree unfolded = unfold_unary(&root_cell->tree, &g);
+    tree parse_tree = bintree_tree(unfolded, si);
+    double lprob = (double) root_cell->lprob;
+
+    free_bintree(unfolded);
+
+    assert(lprob < 0.0);
+    j->lprob = lprob;
+
+    if (probfp)
+      fprintf(probfp, "max_neglog_prob(%d, %g).\n", 
+              sentenceno, -lprob); 
+
+    if (j->out) {
+
+		  if (kbest) {
+		    write_kbest(j->out, c, terms, j->kbest, &g, si);
+		    fprintf(j->out,"\n");
+		  }
+		  else {
+		    fprintf(j->out,"%f\t", lprob);
+		    write_tree(j->out, parse_tree, si);
+		    fprintf(j->out,"\n");
+		  }
+
+      /* fprintf(j->out, "%d ", sentenceno); */
+      /* write_tree(j->out, parse_tree, si); */
+      /* fprintf(j->out, "\n"); */
+      /* /\* write_prolog_tree(j->out, parse_tree, si); *\/ */
+      /* fflush(j->out); */
+
+      if (j->log) {
+        // print time spent parsing
+        fprintf(j->log, "sentence %d: %2lu seconds\n", sentenceno, run_time);
+
+        // print the tree with sentno and log prob
+        fprintf(j->log, "%d %g ", sentenceno, lprob);
+        write_tree(j->log, parse_tree, si);
+        fprintf(j->log, "\n");
+    
+        // print number of edges proposed
+        fprintf(j->log, "%d: proposed %d edges\n", sentenceno, edges_proposed);
+        fprintf(j->log, "%d: probed %d cells\n", sentenceno, cells_probed);
+        if (BEAM_PRUNING)
+          fprintf(j->log, "%d: pruned %d edges\n", sentenceno, edges_pruned);
+        if (astar)
+          fprintf(j->log, "%d: pushed %d edges\n", sentenceno, edges_pushed);
+      }
+
+    }
+
+    free_tree(parse_tree);
+  }		
+
+  else {
+    if (spans) {	/* were the constraints to blame? */
+      coarse_mask all = recognize(constraint_check, terms);
+
+      if (all->parsed) {
+        j->constraint_failed = 1;
+        fprintf(stderr, "Sentence %d: the span constraints leave no parse\n",
+                sentenceno);
+        if (j->log)
+          fprintf(j->log, "%d: the span constraints leave no parse\n",
+                  sentenceno);
+      }
+      free_coarse_mask(all);
+    }
+
+    if (j->log) {
+      // print time spent parsing
+      fprintf(j->log, "sentence %d: %2lu seconds\n", sentenceno, run_time);
+
+      // print the tree with sentno and log prob
+      fprintf(j->log, "%d -inf (TOP)\n", sentenceno);
+    
+      // print number of edges proposed
+      fprintf(j->log, "%d: proposed %d edges\n", sentenceno, edges_proposed);
+      fprintf(j->log, "%d: probed %d cells\n", sentenceno, cells_probed);
+      if (BEAM_PRUNING)
+        fprintf(j->log, "%d: pruned %d edges\n", sentenceno, edges_pruned);
+      if (astar)
+        fprintf(j->log, "%d: pushed %d edges\n", sentenceno, edges_pushed);
+    }
+    if (j->out) {
+      fprintf(j->out, kbest ? "-inf\t(TOP)\n\n" : "-inf\t(TOP)\n");
+		}
+  }
+
+  pthread_rwlock_unlock(&si_lock);
+
+  chart_free(c, terms->n);			/* free the chart */
+
+  if (compare_exhaustive 
+      && (BEAM_PRUNING || mask || astar || restrict_grammar || tag_sets
+          || max_span_width)) {
+    bitword	*tags = tag_sets;
+
+    exhaustive = 1;
+    tag_sets = NULL;
+    c = cky(*terms, g, si, NULL);
+    exhaustive = 0;
+    tag_sets = tags;
+
+    j->compared = 1;
+    if (parsed != chart_root_lprob(c, terms->n, &g, &exhaustive_lprob)
+        || (parsed && fabs(pruned_lprob - exhaustive_lprob) > 1e-6)) {
+      j->changed = 1;
+      if (j->log)
+        fprintf(j->log, "%d: pruning changed the parse\n", sentenceno);
+    }
+    chart_free(c, terms->n);
+  }
+  if (restrict_grammar)
+    free_sentence_grammar(sg);
+  if (tag_sets) {
+    FREE(tag_sets);
+    tag_sets = NULL;
+  }
+  if (mask && mask != live)
+    free_coarse_mask(mask);
+  if (live)
+    free_coarse_mask(live);
+  if (spans && spans != live)
+    free_coarse_mask(spans);
+  assert(trees_allocated == 0);
+  assert(bintrees_allocated == 0);
+}
+
+/* finish_job() adds j's statistics to the totals, and frees it */
+static void
+finish_job(job *j)
+{
+  if (!j->too_long) {
+    if (j->parsed) {
+      parsed_sentences++;
+      sum_neglog_prob -= j->lprob;
+    }
+    else
+      failed_sentences++;
+  }
+  compared_sentences += j->compared;
+  changed_sentences += j->changed;
+  prepass_failures += j->prepass_failed;
+  coarse_fallbacks += j->coarse_fallback;
+  constraint_failures += j->constraint_failed;
+  vindex_free(j->terms);
+}
+
+/* line_terms() returns the words of line as read_terms() would read
+ * them, or NULL if there are none, holding si_lock while it interns
+ * them.
+ */
+static vindex
+line_terms(char *line, si_t si)
+{
+  FILE	 *lfp;
+  vindex terms;
+
+  if (!*line)
+    return NULL;
+  lfp = fmemopen(line, strlen(line), "r");
+  pthread_rwlock_wrlock(&si_lock);
+  terms = read_terms(lfp, si);
+  pthread_rwlock_unlock(&si_lock);
+  fclose(lfp);
+  return terms;
+}
+
+/* read_terms_ahead() reads a sentence as read_terms() does, for the
+ * reader of -j: it reads the sentence's line before it takes si_lock,
+ * so the parsing threads never wait on input.
+ */
+char	*yield_line = NULL;
+size_t	yield_linesize = 0;
+
+static vindex
+read_terms_ahead(FILE *fp, si_t si)
+{
+  if (getline(&yield_line, &yield_linesize, fp) < 0)
+    return NULL;
+  return line_terms(yield_line, si);
+}
+
+/* Parse output (and the log) is flushed after every flush_every
+ * sentences (-F n), or left to stdio's buffering if flush_every is 0.
+ */
+int	flush_every = 1;
+
+static void
+flush_output(FILE *parsefp, FILE *tracefp)
+{
+  static int unflushed = 0;	/* only one thread writes */
+
+  if (flush_every > 0 && ++unflushed >= flush_every) {
+    if (parsefp)
+      fflush(parsefp);
+    if (tracefp)
+      fflush(tracefp);
+    unflushed = 0;
+  }
+}
+
+/* With -j N the corpus goes through a pipeline of three stages: the
+ * main thread reads sentences into a window of jobs, N threads parse
+ * them, and a writer thread writes their output in the corpus's order
+ * and frees them.  The window holds JOBS_PER_THREAD sentences per
+ * parsing thread, so reading stays at most that far ahead, and each
+ * parsing thread takes the most costly sentence in it that no thread
+ * has taken, as estimated by job_cost(), so a long sentence is
+ * started as soon as it is read.  The CPU time the threads spend
+ * parsing is totalled, and compared at the end of the run with the
+ * time the pipeline ran for on nthreads cores.
+ */
+
+double	busy_seconds = 0, pipeline_seconds = 0;
+
+/* job_cost() estimates the time j will take to parse: CKY is cubic in
+ * the sentence's length, and words with more preterminals fill more of
+ * the cells they are in */
+static double
+job_cost(const job *j, const grammar *g)
+{
+  double n = j->terms->n, tags = 0;
+  size_t i;
+
+  if (j->too_long || n == 0)
+    return 0;
+  for (i = 0; i < j->terms->n; i++) {
+    unsigned id = grammar_label_id(g, j->terms->e[i]);
+
+    tags += id != NO_ID && g->child_urs[id].n ? g->child_urs[id].n : 1;
+  }
+  return n * n * tags;
+}
+
+typedef struct pipeline {
+  job		*jobs;		/* the window: the s'th job read is jobs[s % size] */
+  int		size;
+  int		read, written;	/* jobs read and written so far */
+  int		parsing;	/* jobs being parsed */
+  int		eof;		/* set when the reader has read the last job */
+  const grammar	*g;
+  si_t		si;
+  FILE		*parsefp, *tracefp;
+  double	busy;		/* CPU seconds the threads spent parsing */
+  long		blocks;		/* the threads' mmm_blocks_allocated */
+  pthread_t	*threads, writer;
+  pthread_mutex_t lock;
+  pthread_cond_t  ready;	/* signalled when a job is read */
+  pthread_cond_t  done;		/* ... when a job is parsed */
+  pthread_cond_t  space;	/* ... when a job is written */
+} *pipeline;
+
+/* parse_jobs() is a parsing thread */
+static void *
+parse_jobs(void *arg)
+{
+  pipeline p = arg;
+  job	   *j;
+  double   start;
+  int	   s;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    for (j = NULL, s = p->written; s < p->read; s++) {
+      job *k = p->jobs + s % p->size;
+
+      if (!k->taken && (!j || k->cost > j->cost))
+        j = k;
+    }
+    if (!j) {
+      if (p->eof)
+        break;
+      pthread_cond_wait(&p->ready, &p->lock);
+      continue;
+    }
+    j->taken = 1;
+    p->parsing++;
+    pthread_mutex_unlock(&p->lock);
+
+    start = seconds(CLOCK_THREAD_CPUTIME_ID);
+    j->out = open_memstream(&j->outbuf, &j->outsize);
+    j->log = p->tracefp ? open_memstream(&j->logbuf, &j->logsize) : NULL;
+    parse_sentence(j, p->g, p->si);
+    fclose(j->out);
+    if (j->log)
+      fclose(j->log);
+
+    pthread_mutex_lock(&p->lock);
+    p->busy += seconds(CLOCK_THREAD_CPUTIME_ID) - start;
+    p->parsing--;
+    j->done = 1;
+    pthread_cond_broadcast(&p->done);
+  }
+  p->blocks += mmm_blocks_allocated;
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+/* write_jobs() is the writer thread */
+static void *
+write_jobs(void *arg)
+{
+  pipeline p = arg;
+  job	   *j;
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    if (p->written == p->read && p->eof)
+      break;
+    j = p->jobs + p->written % p->size;
+    if (p->written == p->read || !j->done) {
+      pthread_cond_wait(&p->done, &p->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    fwrite(j->outbuf, 1, j->outsize, p->parsefp);
+    free(j->outbuf);		/* allocated by open_memstream() */
+    if (p->tracefp) {
+      fwrite(j->logbuf, 1, j->logsize, p->tracefp);
+      free(j->logbuf);
+    }
+    flush_output(p->parsefp, p->tracefp);
+    finish_job(j);
+
+    pthread_mutex_lock(&p->lock);
+    p->written++;
+    pthread_cond_signal(&p->space);
+  }
+  p->blocks += mmm_blocks_allocated;
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+static pipeline
+make_pipeline(const grammar *g, si_t si, FILE *parsefp, FILE *tracefp)
+{
+  pipeline p = MALLOC(sizeof(struct pipeline));
+  int	   i;
+
+  p->size = nthreads * JOBS_PER_THREAD;
+  p->jobs = MALLOC(p->size * sizeof(job));
+  p->read = p->written = p->parsing = p->eof = 0;
+  p->g = g;
+  p->si = si;
+  p->parsefp = parsefp;
+  p->tracefp = tracefp;
+  p->busy = 0;
+  p->blocks = 0;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->ready, NULL);
+  pthread_cond_init(&p->done, NULL);
+  pthread_cond_init(&p->space, NULL);
+  p->threads = MALLOC(nthreads * sizeof(pthread_t));
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(p->threads + i, NULL, parse_jobs, p)) {
+      fprintf(stderr, "make_pipeline() in llncky.c: Couldn't create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  if (pthread_create(&p->writer, NULL, write_jobs, p)) {
+    fprintf(stderr, "make_pipeline() in llncky.c: Couldn't create thread\n");
+    exit(EXIT_FAILURE);
+  }
+  pipeline_seconds -= seconds(CLOCK_MONOTONIC);
+  return p;
+}
+
+/* pipeline_slot() returns the job the reader should fill next, once
+ * the window has room for it */
+static job *
+pipeline_slot(pipeline p)
+{
+  job *j;
+
+  pthread_mutex_lock(&p->lock);
+  while (p->read - p->written == p->size)
+    pthread_cond_wait(&p->space, &p->lock);
+  j = p->jobs + p->read % p->size;
+  pthread_mutex_unlock(&p->lock);
+  return j;
+}
+
+/* pipeline_push() passes the filled slot on to the parsing threads */
+static void
+pipeline_push(pipeline p, job *j)
+{
+  j->cost = job_cost(j, p->g);
+  j->taken = j->done = 0;
+  pthread_mutex_lock(&p->lock);
+  p->read++;
+  pthread_cond_broadcast(&p->ready);
+  pthread_mutex_unlock(&p->lock);
+}
+
+/* free_pipeline() waits for the jobs read to be written, and frees p */
+static void
+free_pipeline(pipeline p)
+{
+  int i;
+
+  pthread_mutex_lock(&p->lock);
+  p->eof = 1;
+  pthread_cond_broadcast(&p->ready);
+  pthread_cond_broadcast(&p->done);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(p->threads[i], NULL);
+  pthread_join(p->writer, NULL);
+  pipeline_seconds += seconds(CLOCK_MONOTONIC);
+  busy_seconds += p->busy;
+  mmm_blocks_allocated += p->blocks;
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->ready);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->space);
+  FREE(p->threads);
+  FREE(p->jobs);
+  FREE(p);
+}
+
+/* Server mode (-U path) loads the grammar once and then parses
+ * requests sent over a Unix domain socket at path, or over stdin and
+ * stdout with "-U -".  A request is a line holding a sentence, which
+ * may be preceded by options and a tab: maxlen=N, kbest=K and
+ * timeout=SECONDS, separated by spaces, override -m, -N and the default
+ * of no timeout for that sentence.  The response is a line "status
+ * seconds", where status is ok, noparse, toolong or timeout and
+ * seconds is the time the parse took, then the parses as they are
+ * written for a corpus, then an empty line; a bad request gets "error
+ * message" and an empty line.  Each connection is served by one of
+ * nthreads (-j N) threads, so N clients are served at once.
+ */
+
+#define SERVER_BACKLOG	64	/* connections waiting for a thread */
+
+char	*server_path = NULL;	/* -U path */
+int	server_requests = 0;	/* numbers the requests, as sentences */
+
+typedef struct server {
+  const grammar	*g;
+  si_t		si;
+  int		maxsentlen;		/* -m */
+  int		fds[SERVER_BACKLOG];	/* accepted connections, a queue */
+  int		first, n;
+  pthread_mutex_t lock;
+  pthread_cond_t  ready, space;
+} server;
+
+/* serve_request() parses the request on line and writes the response
+ * to out */
+static void
+serve_request(char *line, FILE *out, server *sv)
+{
+  char	 *words = strchr(line, '\t'), *opt, *rest;
+  int	 maxlen = sv->maxsentlen, nbest = kbest;
+  double timeout = 0, start;
+  job	 j;
+
+  if (words) {
+    *words++ = '\0';
+    for (opt = strtok_r(line, " ", &rest); opt; opt = strtok_r(NULL, " ", &rest))
+      if (sscanf(opt, "maxlen=%d", &maxlen) == 1 && maxlen >= 0)
+        continue;
+      else if (sscanf(opt, "kbest=%d", &nbest) == 1 && nbest >= 1) {
+        if (!kbest && nbest > 1) {
+          fprintf(out, "error kbest needs the server to be run with -N\n\n");
+          return;
+        }
+      }
+      else if (sscanf(opt, "timeout=%lf", &timeout) != 1 || timeout < 0) {
+        fprintf(out, "error bad option %s\n\n", opt);
+        return;
+      }
+  }
+  else
+    words = line;
+
+  if (!(j.terms = line_terms(words, sv->si))) {
+    fprintf(out, "error no words\n\n");
+    return;
+  }
+  j.sentenceno = __sync_add_and_fetch(&server_requests, 1);
+  j.too_long = maxlen && (int) j.terms->n > maxlen;
+  j.c = NULL;
+  j.spans = NULL;
+  pthread_rwlock_wrlock(&si_lock);
+  j.tag_sets = tag_dictionary && !j.too_long ?
+    make_tag_sets(j.terms, sv->g, sv->si, j.sentenceno) : NULL;
+  pthread_rwlock_unlock(&si_lock);
+  j.kbest = nbest;
+  j.parsed = j.compared = j.changed = 0;
+  j.prepass_failed = j.coarse_fallback = j.constraint_failed = 0;
+  j.out = open_memstream(&j.outbuf, &j.outsize);
+  j.log = NULL;
+
+  start = seconds(CLOCK_MONOTONIC);
+  timed_out = 0;
+  deadline = timeout > 0 ? start + timeout : 0;
+  parse_sentence(&j, sv->g, sv->si);
+  deadline = 0;
+  fclose(j.out);
+
+  fprintf(out, "%s %g\n", j.too_long ? "toolong" : j.parsed ? "ok" 
+          : timed_out ? "timeout" : "noparse", seconds(CLOCK_MONOTONIC) - start);
+  fwrite(j.outbuf, 1, j.outsize, out);
+  if (!kbest)
+    fputc('\n', out);	/* k-best output already ends with one */
+  free(j.outbuf);	/* allocated by open_memstream() */
+  vindex_free(j.terms);
+}
+
+/* serve() answers the requests read from in until it runs out */
+static void
+serve(FILE *in, FILE *out, server *sv)
+{
+  char	  *line = NULL;
+  size_t  size = 0;
+  ssize_t len;
+
+  while ((len = getline(&line, &size, in)) > 0) {
+    if (line[len-1] == '\n')
+      line[len-1] = '\0';
+    serve_request(line, out, sv);
+    if (fflush(out))
+      break;		/* the client has gone */
+  }
+  free(line);		/* allocated by getline() */
+}
+
+/* serve_connections() is a server thread */
+static void *
+serve_connections(void *arg)
+{
+  server *sv = arg;
+  FILE	 *in, *out;
+  int	 fd;
+
+  for (;;) {
+    pthread_mutex_lock(&sv->lock);
+    while (sv->n == 0)
+      pthread_cond_wait(&sv->ready, &sv->lock);
+    fd = sv->fds[sv->first];
+    sv->first = (sv->first + 1) % SERVER_BACKLOG;
+    sv->n--;
+    pthread_cond_signal(&sv->space);
+    pthread_mutex_unlock(&sv->lock);
+
+    if (!(in = fdopen(fd, "r")) || !(out = fdopen(dup(fd), "w"))) {
+      fprintf(stderr, "serve_connections() in llncky.c: Couldn't open connection\n");
+      if (in)
+        fclose(in);
+      else
+        close(fd);
+      continue;
+    }
+    serve(in, out, sv);
+    fclose(in);
+    fclose(out);
+  }
+  return NULL;
+}
+
+/* serve_socket() listens on a Unix domain socket at path, and hands
+ * the connections to nthreads threads to serve with sv.  It never
+ * returns.
+ */
+static void
+serve_socket(const char *path, server *sv)
+{
+  struct sockaddr_un addr;
+  pthread_t	     thread;
+  int		     fd, conn, i;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "serve_socket() in llncky.c: Socket path too long: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+      || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(fd, SERVER_BACKLOG) < 0) {
+    fprintf(stderr, "serve_socket() in llncky.c: Couldn't listen on %s: %s\n",
+            path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  sv->first = sv->n = 0;
+  pthread_mutex_init(&sv->lock, NULL);
+  pthread_cond_init(&sv->ready, NULL);
+  pthread_cond_init(&sv->space, NULL);
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&thread, NULL, serve_connections, sv)
+        || pthread_detach(thread)) {
+      fprintf(stderr, "serve_socket() in llncky.c: Couldn't create thread\n");
+      exit(EXIT_FAILURE);
+    }
+
+  for (;;) {
+    if ((conn = accept(fd, NULL, NULL)) < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fprintf(stderr, "serve_socket() in llncky.c: accept() failed: %s\n",
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&sv->lock);
+    while (sv->n == SERVER_BACKLOG)
+      pthread_cond_wait(&sv->space, &sv->lock);
+    sv->fds[(sv->first + sv->n++) % SERVER_BACKLOG] = conn;
+    pthread_cond_signal(&sv->ready);
+    pthread_mutex_unlock(&sv->lock);
+  }
+}
+
+ void usage() {
+  printf("llncky [-m maxsentlen] [-f from] [-t to] [-o outfile] [-l logfile] [-c hash|dense] [-b grammar|cell|auto] [-k beamwidth] [-p beammargin] [-C threshold] [-B constraints] [-D cutoff] [-T tags] [-L] [-W width] [-I] [-r] [-R] [-a] [-x] [-P threshold] [-N k] [-S viterbi|inside|prob|count|recognize] [-s] [-j threads] [-J threads] [-F n] [-U socket] corpus grammar\n");
+  exit(EXIT_FAILURE);
+}
+
+int      
+main(int argc, char **argv)
+{
+  si_t          si = make_si(1024);
+  FILE          *grammarfp = stdin, *yieldfp = NULL;
+  FILE	        *tracefp = NULL;  	/* trace output */
+  FILE		*summaryfp = NULL;	/* end of parse stats output */
+  FILE		*parsefp = stdout;      /* parse trees */
+
+  grammar	g;
+  chart		c = NULL;
+  vindex 	terms;
+  job		serial_job, *j;
+  pipeline	pipe = NULL;
+  int		maxsentlen = 100, maxsentlen_set = 0;
+  int           sentfrom = 0, sentto = 0;
+
+  rand_seed = RAND_SEED;	/* seed the tie-breaking keys */
+
+  int arg;
+  opterr = 0;
+
+  while ((arg = getopt(argc,argv,"m:l:o:f:t:c:b:k:p:C:B:D:T:LW:IrRaxP:N:S:sj:J:F:U:v")) != -1) { 
+    switch (arg) {
+    case 'm':
+      if (!sscanf(optarg, "%d", &maxsentlen)) {
+        fprintf(stderr, "%s: Couldn't parse maxsentlen %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      maxsentlen_set = 1;
+      break;
+    case 'f':
+      if (!sscanf(optarg, "%d", &sentfrom)) {
+        fprintf(stderr, "%s: Couldn't parse from %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 't':
+      if (!sscanf(optarg, "%d", &sentto)) {
+        fprintf(stderr, "%s: Couldn't parse from %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
     case 'l': // logfile
       if ((tracefp = fopen(optarg, "w")) == NULL) {
         fprintf(stderr, "%s: Couldn't open tracefile %s\n", argv[0], optarg);
@@ -406,6 +3924,142 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
       }
       break;
+    case 'c': // chart entry representation
+      if (!strcmp(optarg, "dense"))
+        dense_chart = 1;
+      else if (!strcmp(optarg, "hash"))
+        dense_chart = 0;
+      else {
+        fprintf(stderr, "%s: Unknown chart type %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'b': // binary rule loop order
+      if (!strcmp(optarg, "grammar"))
+        binary_order = BINARY_GRAMMAR;
+      else if (!strcmp(optarg, "cell"))
+        binary_order = BINARY_CELL;
+      else if (!strcmp(optarg, "auto"))
+        binary_order = BINARY_AUTO;
+      else {
+        fprintf(stderr, "%s: Unknown binary rule order %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'k': // beam width
+      if (!sscanf(optarg, "%d", &beam_width) || beam_width < 0) {
+        fprintf(stderr, "%s: Couldn't parse beam width %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p': // beam margin
+      if (!sscanf(optarg, "%lg", &beam_margin) || beam_margin < 0) {
+        fprintf(stderr, "%s: Couldn't parse beam margin %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'C': // coarse-to-fine posterior threshold
+      if (!sscanf(optarg, "%lg", &coarse_threshold) 
+          || coarse_threshold <= 0 || coarse_threshold >= 1) {
+        fprintf(stderr, "%s: Couldn't parse coarse threshold %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'a': // A* parsing
+      astar = 1;
+      break;
+    case 'B': // span constraints
+      if ((constraintfp = fopen(optarg, "r")) == NULL) {
+        fprintf(stderr, "%s: Couldn't open constraint file %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'D': // tag dictionary cutoff
+      if (!sscanf(optarg, "%lg", &tag_cutoff) || tag_cutoff <= 0) {
+        fprintf(stderr, "%s: Couldn't parse tag cutoff %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'T': // tagger output
+      if ((tagfp = fopen(optarg, "r")) == NULL) {
+        fprintf(stderr, "%s: Couldn't open tag file %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'W': // maximum span width
+      if (!sscanf(optarg, "%d", &max_span_width) || max_span_width < 1) {
+        fprintf(stderr, "%s: Couldn't parse span width %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'I': // parse each word as it is read
+      incremental = 1;
+      break;
+    case 'L': // the corpus is word lattices
+      lattice_input = 1;
+      break;
+    case 'r': // restrict the grammar to each sentence
+      restrict_grammar = 1;
+      break;
+    case 'R': // recognition prepass
+      recognize_first = 1;
+      break;
+    case 'P': // print posteriors
+      if (!sscanf(optarg, "%lg", &posterior_threshold) 
+          || posterior_threshold <= 0 || posterior_threshold > 1) {
+        fprintf(stderr, "%s: Couldn't parse posterior threshold %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'N': // k-best parses
+      if (!sscanf(optarg, "%d", &kbest) || kbest < 1) {
+        fprintf(stderr, "%s: Couldn't parse number of parses %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'j': // threads
+      if (!sscanf(optarg, "%d", &nthreads) || nthreads < 1) {
+        fprintf(stderr, "%s: Couldn't parse number of threads %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'J': // threads per sentence
+      if (!sscanf(optarg, "%d", &wavefront_threads) || wavefront_threads < 1) {
+        fprintf(stderr, "%s: Couldn't parse number of threads %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'F': // flush policy
+      if (!sscanf(optarg, "%d", &flush_every) || flush_every < 0) {
+        fprintf(stderr, "%s: Couldn't parse flush interval %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'U': // serve requests on a socket, or stdin if -
+      server_path = optarg;
+      break;
+    case 's': // surprisals
+      surprisal = 1;
+      break;
+    case 'S': // root value over a semiring
+      if (!strcmp(optarg, "viterbi"))
+        semiring = SEMIRING_VITERBI;
+      else if (!strcmp(optarg, "inside"))
+        semiring = SEMIRING_INSIDE;
+      else if (!strcmp(optarg, "prob"))
+        semiring = SEMIRING_PROB;
+      else if (!strcmp(optarg, "count"))
+        semiring = SEMIRING_COUNT;
+      else if (!strcmp(optarg, "recognize"))
+        semiring = SEMIRING_RECOGNIZE;
+      else {
+        fprintf(stderr, "%s: Unknown semiring %s\n", argv[0], optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'x': // compare pruned parses with exhaustive ones
+      compare_exhaustive = 1;
+      break;
     case 'v': // verbose output
       verbose = 1;
       break;
@@ -422,11 +4076,61 @@ main(int argc, char **argv)
     }
   }
 
-  if ( (argc - optind) != 2 )
+  if ( (argc - optind) != (server_path ? 1 : 2) )
     usage();
 
+  if (kbest && astar) {
+    fprintf(stderr, "%s: -N needs the whole chart, which -a doesn't build\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (lattice_input 
+      && (astar || kbest || coarse_threshold > 0 || recognize_first 
+          || restrict_grammar || tagfp || tag_cutoff > 0 
+          || posterior_threshold > 0 || semiring || surprisal || dense_chart)) {
+    fprintf(stderr, "%s: -L only works with CKY over hash chart entries\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (max_span_width 
+      && (astar || kbest || coarse_threshold > 0 || recognize_first
+          || constraintfp || posterior_threshold > 0 || semiring || surprisal)) {
+    fprintf(stderr, "%s: -W only works with CKY\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (incremental 
+      && (astar || coarse_threshold > 0 || recognize_first || constraintfp
+          || restrict_grammar || tagfp || tag_cutoff > 0 || lattice_input
+          || max_span_width || posterior_threshold > 0 || semiring || surprisal)) {
+    fprintf(stderr, "%s: -I only works with CKY\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (nthreads > 1
+      && (incremental || lattice_input || posterior_threshold > 0 || semiring
+          || surprisal)) {
+    fprintf(stderr, "%s: -j only works with the Viterbi parsers\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (wavefront_threads > 1
+      && (nthreads > 1 || astar || incremental || posterior_threshold > 0 
+          || semiring || surprisal)) {
+    fprintf(stderr, "%s: -J only works with CKY, and not with -j\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (server_path
+      && (incremental || lattice_input || constraintfp || tagfp 
+          || wavefront_threads > 1 || compare_exhaustive 
+          || posterior_threshold > 0 || semiring || surprisal)) {
+    fprintf(stderr, "%s: -U only works with the Viterbi parsers\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (max_span_width && !maxsentlen_set)
+    maxsentlen = 0;		/* sentences of any length */
+
   int from_stdin = 0;
-  if (! strcmp(argv[optind],"-")) {
+  if (server_path)
+    ;			/* the requests are the corpus */
+  else if (! strcmp(argv[optind],"-")) {
 	yieldfp = stdin;
 	from_stdin = 1;
   } else {  
@@ -436,127 +4140,182 @@ main(int argc, char **argv)
 	}
   }  
 
-  if ((grammarfp = fopen(argv[optind+1], "r")) == NULL) {
+  if ((grammarfp = fopen(argv[optind + !server_path], "r")) == NULL) {
     fprintf(stderr, "%s: Couldn't open grammarfile %s\n", argv[0], optarg);
     exit(EXIT_FAILURE);
   }
 
   g = read_grammar(grammarfp, si);
+  if (coarse_threshold > 0)
+    coarse_grammar = make_coarse(grammarfp, &g, si, coarse_threshold);
+  if (recognize_first)
+    prepass = make_recognizer(&g);
+  if (constraintfp)
+    constraint_check = make_recognizer(&g);
+  if (tag_cutoff > 0)
+    tag_dictionary = make_tag_dict(grammarfp, &g, si, tag_cutoff);
+  tag_words = BITSET_WORDS(g.nnts);
+  if (astar)
+    astar_est = make_astar_estimates(&g, si);
+  if (posterior_threshold > 0)
+    posterior_grammar = make_inout_grammar(&g);
+  if (kbest)
+    kbest_ix = make_kbest_index(&g);
+  if (surprisal)
+    surprisal_grammar = make_prefix_grammar(&g);
+  if (wavefront_threads > 1)
+    wavefront_pool = make_pool(wavefront_threads - 1);
+  make_semiring_grammar(&g);
   /* write_grammar(tracefp, g, si); */
+  if (max_span_width)
+    si_string_index(si, glue);	/* so parsers only look it up */
+  if (server_path) {
+    server sv;
 
-  while ((terms = read_terms(yieldfp, si))) {
-    sentenceno++;
-    edges_proposed = 0;
+    sv.g = &g;
+    sv.si = si;
+    sv.maxsentlen = maxsentlen;
+    signal(SIGPIPE, SIG_IGN);	/* clients may hang up mid-response */
+    if (strcmp(server_path, "-"))
+      serve_socket(server_path, &sv);
+    serve(stdin, parsefp, &sv);
+  }
+  else if (nthreads > 1)
+    pipe = make_pipeline(&g, si, parsefp, tracefp);
 
+  while (yieldfp && (terms = incremental ? 
+          read_incrementally(yieldfp, si, &g, &c, maxsentlen, tracefp)
+          : lattice_input ? read_lattice(yieldfp, si)
+          : pipe ? read_terms_ahead(yieldfp, si) : read_terms(yieldfp, si))) {
+    sentenceno++;
+    if (constraintfp)
+      read_line(constraintfp, &constraint_line, &constraint_linesize);
+    if (tagfp)
+      read_line(tagfp, &tag_line, &tag_linesize);
     if (sentfrom && sentenceno < sentfrom) {
+      if (incremental)
+        chart_free(c, c->n);
       vindex_free(terms);
       continue;
     }
     if (sentto && sentenceno > sentto) {
       sentenceno--;
+      if (incremental)
+        chart_free(c, c->n);
       vindex_free(terms);
       break;
     }
 
-    /* skip if sentence is too long */
-    if (!maxsentlen || (int) terms->n <= maxsentlen) { 
-
-      /* size_t	i; */
-      /* if (tracefp) { */
-      /*   fprintf(tracefp, "Sentence %d:", sentenceno); */
-      /*   for (i=0; i<terms->n; i++) */
-      /*     fprintf(tracefp, " %s", si_index_string(si, terms->e[i])); */
-      /*   fprintf(tracefp, "\n"); */
-      /* } */
-
-      time_t start_time = time(0);
-     
-      c = cky(*terms, g, si);
-
-      time_t run_time = time(0) - start_time;
-
-      /* fetch best root node */
-
-      root_cell = sihashcc_ref(CHART_ENTRY(c, 0, terms->n), g.root_label);
-
-      if (root_cell) {
-        tree parse_tree = bintree_tree(&root_cell->tree, si);
-        double lprob = (double) root_cell->lprob;
-
-        parsed_sentences++;
-        assert(lprob < 0.0);
-        sum_neglog_prob -= lprob;
-
-        if (probfp)
-          fprintf(probfp, "max_neglog_prob(%d, %g).\n", 
-                  sentenceno, -lprob); 
-
-        if (parsefp) {
-
-		  fprintf(parsefp,"%f\t", lprob);
-		  write_tree(parsefp, parse_tree, si);
-		  fprintf(parsefp,"\n");
-		  fflush(parsefp);
-
-          /* fprintf(parsefp, "%d ", sentenceno); */
-          /* write_tree(parsefp, parse_tree, si); */
-          /* fprintf(parsefp, "\n"); */
-          /* /\* write_prolog_tree(parsefp, parse_tree, si); *\/ */
-          /* fflush(parsefp); */
+    if (semiring) {
+      if (parsefp)
+        write_semiring_value(parsefp, terms, 
+                             maxsentlen && (int) terms->n > maxsentlen);
+      flush_output(parsefp, NULL);
+      vindex_free(terms);
+      continue;
+    }
 
-          if (tracefp) {
-            // print time spent parsing
-            fprintf(tracefp, "sentence %d: %2lu seconds\n", sentenceno, run_time);
+    if (surprisal_grammar) {
+      if (parsefp)
+        write_surprisals(parsefp, terms, 
+                         maxsentlen && (int) terms->n > maxsentlen, si);
+      flush_output(parsefp, NULL);
+      vindex_free(terms);
+      continue;
+    }
 
-            // print the tree with sentno and log prob
-            fprintf(tracefp, "%d %g ", sentenceno, lprob);
-            write_tree(tracefp, parse_tree, si);
-            fprintf(tracefp, "\n");
-        
-            // print number of edges proposed
-            fprintf(tracefp, "%d: proposed %d edges\n", sentenceno, edges_proposed);
-            fflush(tracefp);
-          }
+    if (posterior_grammar) {
+      if (parsefp)
+        write_posteriors(parsefp, terms, 
+                         maxsentlen && (int) terms->n > maxsentlen, si);
+      flush_output(parsefp, NULL);
+      vindex_free(terms);
+      continue;
+    }
 
-        }
+    j = pipe ? pipeline_slot(pipe) : &serial_job;
+    j->sentenceno = sentenceno;
+    j->terms = terms;
+    j->too_long = maxsentlen && (int) terms->n > maxsentlen;
+    j->c = incremental ? c : NULL;
+    j->spans = constraintfp && !j->too_long ?
+      constraint_mask(terms->n, &g, sentenceno) : NULL;
+    pthread_rwlock_wrlock(&si_lock);	/* tags are interned */
+    j->tag_sets = (tagfp || tag_dictionary) && !j->too_long ?
+      make_tag_sets(terms, &g, si, sentenceno) : NULL;
+    pthread_rwlock_unlock(&si_lock);
+    j->kbest = kbest;
+    j->parsed = j->compared = j->changed = 0;
+    j->prepass_failed = j->coarse_fallback = j->constraint_failed = 0;
 
-        free_tree(parse_tree);
-      }		
+    if (pipe)
+      pipeline_push(pipe, j);
+    else {
+      j->out = parsefp;
+      j->log = tracefp;
+      parse_sentence(j, &g, si);
+      flush_output(parsefp, tracefp);
+      finish_job(j);
+    }
+  }
+  if (pipe)
+    free_pipeline(pipe);
+  if (yield_line)
+    free(yield_line);	/* allocated by getline() */
+  free_grammar(g);
+  if (coarse_grammar)
+    free_coarse(coarse_grammar);
+  if (prepass)
+    free_recognizer(prepass);
+  if (ends)
+    FREE(ends);
+  if (constraint_check) {
+    free_recognizer(constraint_check);
+    fclose(constraintfp);
+    free(constraint_line);	/* allocated by getline() */
+  }
+  if (lattice)
+    FREE(lattice);
+  if (tag_dictionary)
+    free_tag_dict(tag_dictionary);
+  if (tagfp) {
+    fclose(tagfp);
+    free(tag_line);
+  }
+  if (astar_est)
+    free_astar_estimates(astar_est);
+  if (wavefront_pool)
+    free_pool(wavefront_pool);
+  if (posterior_grammar)
+    free_inout_grammar(posterior_grammar);
+  if (surprisal_grammar)
+    free_prefix_grammar(surprisal_grammar);
+  if (kbest_ix)
+    free_kbest_index(kbest_ix);
+  free_semiring_grammar();
+  si_free(si);
 
-      else {
-        failed_sentences++;
+  if (constraint_failures)
+    fprintf(stderr, "The span constraints left no parse for %d sentences\n",
+            constraint_failures);
 
-        if (tracefp) {
-          // print time spent parsing
-          fprintf(tracefp, "sentence %d: %2lu seconds\n", sentenceno, run_time);
+  if (prepass_failures)
+    fprintf(stderr, "The recognition prepass found no parse for %d sentences\n",
+            prepass_failures);
 
-          // print the tree with sentno and log prob
-          fprintf(tracefp, "%d -inf (TOP)\n", sentenceno);
-        
-          // print number of edges proposed
-          fprintf(tracefp, "%d: proposed %d edges\n", sentenceno, edges_proposed);
-        }
-        if (parsefp) {
-          fprintf(parsefp, "-inf\t(TOP)\n");
-		  fflush(parsefp);
-		}
-      }
+  if (coarse_fallbacks)
+    fprintf(stderr, "Coarse pruning left no parse for %d sentences, which were reparsed\n",
+            coarse_fallbacks);
 
-      chart_free(c, terms->n);			/* free the chart */
-    }
-    else { 					/* sentence too long */
-      if (parsefp) {
-        fprintf(parsefp, "-inf\t(TOP)\n");
-		fflush(parsefp);
-	  }
-    }
+  if (compared_sentences)
+    fprintf(stderr, "Pruning changed the Viterbi parse of %d/%d = %g%% sentences\n",
+            changed_sentences, compared_sentences,
+            (100.0 * changed_sentences) / compared_sentences);
 
-    vindex_free(terms);				/*  free the terms */
-    assert(trees_allocated == 0);
-    assert(bintrees_allocated == 0);
-  }
-  free_grammar(g);
-  si_free(si);
+  if (pipeline_seconds > 0)
+    fprintf(stderr, "The %d threads used %g%% of %d cores for %gs\n",
+            nthreads, (100.0 * busy_seconds) / (nthreads * pipeline_seconds),
+            nthreads, pipeline_seconds);
 
   if (summaryfp) {
     fprintf(summaryfp, "\n%d/%d = %g%% test sentences met the length criteron,"
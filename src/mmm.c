@@ -20,7 +20,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-long	mmm_blocks_allocated = 0;      /* number of currently allocated blocks */
+__thread long mmm_blocks_allocated = 0; /* blocks this thread allocated less those it freed */
 
 void *mmm_malloc(size_t n)
 {
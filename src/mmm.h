@@ -18,7 +18,7 @@
 
 #include <stdlib.h>
 
-extern	long	mmm_blocks_allocated;
+extern __thread long mmm_blocks_allocated;
 
 #define CALLOC(n,m)	mmm_calloc(n,m)
 #define MALLOC(n)	mmm_malloc(n)
@@ -31,7 +31,7 @@ struct blockalloc {
   struct blockalloc *next;
 };
 
-static struct blockalloc *current_block;
+static __thread struct blockalloc *current_block;	/* each thread has its own */
 
 void
 blockalloc_free_all(void)
@@ -66,6 +66,32 @@ blockalloc_malloc(size_t n_char)
   return (void *) &p->data[p->top];
 }
 
+struct blockalloc *
+blockalloc_take(void)
+{
+  struct blockalloc *p = current_block;
+
+  current_block = NULL;
+  return p;
+}
+
+void
+blockalloc_give(struct blockalloc *blocks)
+{
+  struct blockalloc *p = blocks;
+
+  if (!p)
+    return;
+  if (!current_block) {
+    current_block = blocks;
+    return;
+  }
+  while (p->next)
+    p = p->next;
+  p->next = current_block->next;	/* we keep allocating from ours */
+  current_block->next = blocks;
+}
+
 /* now here is the hash code
  */
 
@@ -0,0 +1,351 @@
+/* prefix.c -- prefix probabilities
+ *
+ * The chart grows a column of spans for each word.  The inside scores
+ * of the new spans are computed as in inout.c, and then the prefix
+ * scores of the spans from each i to the new word k, from the right:
+ *
+ *   base(B, i, k)  = P(B -> w_i ...)                          if i = k-1
+ *                  = sum over B -> C D and i < j < k of
+ *                    P(B -> C D) inside(C, i, j) prefix(D, j, k)  otherwise
+ *
+ *   prefix(A, i, k) = sum over B of R(A, B) base(B, i, k)
+ *
+ * where R is the left corner closure, which sums over the ways A can
+ * have B as a left corner (the rest of each rule being in the future,
+ * with probability 1).  R is the inverse of I - L, where L(A, B) is the
+ * probability of A's left child being B (or having B at the bottom of
+ * one of its unary chains).  It is computed once by make_sum_closure()
+ * (see closure.h), which only inverts within the strongly connected
+ * components of the left corner graph, and only keeps the pairs that
+ * are connected.  As in inout.c, the scores are probabilities scaled
+ * by span, and unary chains are summed with the grammar's sum closure.
+ */
+
+#include "prefix.h"
+#include "mmm.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+prefix_grammar
+make_prefix_grammar(const grammar *g)
+{
+  prefix_grammar pg = MALLOC(sizeof(struct prefix_grammar));
+  size_t	 n = g->nnts, nedges = 0, esize = n + 1, b, i, r, ntouched;
+  FLOAT		 *left = CALLOC(n, sizeof(FLOAT));	/* L(., b) */
+  char		 *seen = CALLOC(n, sizeof(char));
+  unsigned	 *touched = MALLOC(n * sizeof(unsigned));
+  closure_edge	 *edges = MALLOC(esize * sizeof(closure_edge));
+  sum_closure	 u;
+
+  pg->ig = make_inout_grammar(g);
+  u = pg->ig->unary;
+
+  /* L(a, b) sums the rules whose left child x has b at the bottom of
+   * its unary chains; each is an edge from b up to a.
+   */
+  for (b = 0; b < n; b++) {
+    ntouched = 0;
+    for (i = u->start[b]; i < u->start[b+1]; i++) {
+      const bpair *bp, *end = g->bpairs + g->bleft_start[u->sums[i].to+1];
+
+      for (bp = g->bpairs + g->bleft_start[u->sums[i].to]; bp < end; bp++)
+        for (r = bp->start; r < bp[1].start; r++) {
+          unsigned a = g->label_id[g->bparents[r].parent];
+
+          if (!seen[a]) {
+            seen[a] = 1;
+            touched[ntouched++] = a;
+          }
+          left[a] += u->sums[i].sum * pg->ig->bprob[r];
+        }}
+    for (i = 0; i < ntouched; i++) {
+      if (nedges >= esize) {
+        esize *= 2;
+        edges = REALLOC(edges, esize * sizeof(closure_edge));
+      }
+      edges[nedges].from = b;
+      edges[nedges].to = touched[i];
+      edges[nedges++].weight = left[touched[i]];
+      left[touched[i]] = 0;
+      seen[touched[i]] = 0;
+    }}
+
+  pg->lcorners = make_sum_closure(n, edges, nedges);
+  for (i = 0; i < pg->lcorners->start[n]; i++)
+    if (pg->lcorners->sums[i].sum > 1e300) {
+      fprintf(stderr, "make_prefix_grammar() in prefix.c: left corner probabilities of %u don't converge\n", pg->lcorners->sums[i].to);
+      exit(EXIT_FAILURE);
+    }
+
+  FREE(left);
+  FREE(seen);
+  FREE(touched);
+  FREE(edges);
+  return pg;
+}
+
+void
+free_prefix_grammar(prefix_grammar pg)
+{
+  free_inout_grammar(pg->ig);
+  free_sum_closure(pg->lcorners);
+  FREE(pg);
+}
+
+struct prefix_chart {
+  prefix_grammar pg;
+  size_t	n, nsize;	/* words so far, and room */
+  size_t	nnts, words;
+  unsigned	*term;		/* id of each word */
+  FLOAT		*ins_pre, *ins_post, *iscale;	/* inside, by span */
+  bitword	*pre, *post;	/* labels with inside scores */
+  FLOAT		*pfx_pre, *pfx_post, *pscale;	/* prefix of i..n, by i */
+  FLOAT		*base;
+  FLOAT		lprob;		/* log prefix prob of the words so far */
+};
+
+#define SCORES(pc, a, s)	((pc)->a + (s)*(pc)->nnts)
+#define LABELS(pc, a, s)	((pc)->a + (s)*(pc)->words)
+
+prefix_chart
+make_prefix_chart(prefix_grammar pg)
+{
+  prefix_chart pc = CALLOC(1, sizeof(struct prefix_chart));
+
+  pc->pg = pg;
+  pc->nnts = pg->ig->g->nnts;
+  pc->words = BITSET_WORDS(pc->nnts);
+  pc->base = MALLOC(pc->nnts * sizeof(FLOAT));
+  pc->lprob = 0;		/* every sentence starts with no words */
+  return pc;
+}
+
+void
+free_prefix_chart(prefix_chart pc)
+{
+  if (pc->nsize) {
+    FREE(pc->term);
+    FREE(pc->ins_pre);
+    FREE(pc->ins_post);
+    FREE(pc->iscale);
+    FREE(pc->pre);
+    FREE(pc->post);
+    FREE(pc->pfx_pre);
+    FREE(pc->pfx_post);
+    FREE(pc->pscale);
+  }
+  FREE(pc->base);
+  FREE(pc);
+}
+
+/* grow() makes room in pc for at least n words */
+static void
+grow(prefix_chart pc, size_t n)
+{
+  size_t nspans;
+
+  pc->nsize = pc->nsize ? 2 * pc->nsize : 16;
+  if (pc->nsize < n)
+    pc->nsize = n;
+  nspans = INOUT_SPAN(0, pc->nsize+1);
+  pc->term = REALLOC(pc->term, pc->nsize * sizeof(unsigned));
+  pc->ins_pre = REALLOC(pc->ins_pre, nspans * pc->nnts * sizeof(FLOAT));
+  pc->ins_post = REALLOC(pc->ins_post, nspans * pc->nnts * sizeof(FLOAT));
+  pc->iscale = REALLOC(pc->iscale, nspans * sizeof(FLOAT));
+  pc->pre = REALLOC(pc->pre, nspans * pc->words * sizeof(bitword));
+  pc->post = REALLOC(pc->post, nspans * pc->words * sizeof(bitword));
+  pc->pfx_pre = REALLOC(pc->pfx_pre, pc->nsize * pc->nnts * sizeof(FLOAT));
+  pc->pfx_post = REALLOC(pc->pfx_post, pc->nsize * pc->nnts * sizeof(FLOAT));
+  pc->pscale = REALLOC(pc->pscale, pc->nsize * sizeof(FLOAT));
+}
+
+/* close_layers() scales pre, whose scores have log scale scale, so its
+ * largest score is 1, adds it and its unary ancestors to post, and
+ * returns its new log scale.  Labels added to post are set in labels.
+ */
+static FLOAT
+close_layers(prefix_chart pc, const grammar *g, FLOAT *pre, FLOAT *post,
+             bitword *labels, FLOAT scale)
+{
+  const sum_closure u = pc->pg->ig->unary;
+  FLOAT		    max = 0, norm;
+  size_t	    b, x;
+
+  for (b = 0; b < g->nnts; b++)
+    if (pre[b] > max)
+      max = pre[b];
+  if (max == 0)
+    return scale;
+  norm = 1 / max;
+  for (b = 0; b < g->nnts; b++) {
+    FLOAT p = pre[b] *= norm;
+
+    if (p == 0)
+      continue;
+    for (x = u->start[b]; x < u->start[b+1]; x++) {
+      post[u->sums[x].to] += p * u->sums[x].sum;
+      if (labels)
+        BITSET_SET(labels, u->sums[x].to);
+    }}
+  return scale + log(max);
+}
+
+/* inside_score() returns the scaled inside score of id in j..k */
+static inline FLOAT
+inside_score(const prefix_chart pc, unsigned id, size_t j, size_t k)
+{
+  size_t s = INOUT_SPAN(j, k);
+
+  if (id < pc->nnts)
+    return BITSET_TEST(LABELS(pc, post, s), id) ? SCORES(pc, ins_post, s)[id] : 0;
+  /* a terminal's inside score is 1 */
+  return k == j+1 && id == pc->term[j] ? exp(-pc->iscale[s]) : 0;
+}
+
+/* prefix_score() returns the scaled prefix score of id in j..n */
+static inline FLOAT
+prefix_score(const prefix_chart pc, unsigned id, size_t j)
+{
+  if (id < pc->nnts)
+    return SCORES(pc, pfx_post, j)[id];
+  return j == pc->n-1 && id == pc->term[j] ? exp(-pc->pscale[j]) : 0;
+}
+
+/* binary() adds the parents of left child b over i..j (with score
+ * lscore) and each right child over j..k to scores, taking the right
+ * child's inside score, or its prefix score if prefix is set.
+ */
+static void
+binary(prefix_chart pc, const grammar *g, unsigned b, FLOAT lscore,
+       size_t i, size_t j, size_t k, int prefix, FLOAT *scores, bitword *labels)
+{
+  const bpair *bp, *end = g->bpairs + g->bleft_start[b+1];
+  size_t      r;
+
+  for (bp = g->bpairs + g->bleft_start[b]; bp < end; bp++) {
+    FLOAT rscore = lscore * (prefix ? prefix_score(pc, bp->right, j)
+                             : inside_score(pc, bp->right, j, k));
+
+    if (rscore == 0)
+      continue;
+    for (r = bp->start; r < bp[1].start; r++) {
+      unsigned p = g->label_id[g->bparents[r].parent];
+
+      scores[p] += rscore * pc->pg->ig->bprob[r];
+      if (labels)
+        BITSET_SET(labels, p);
+    }}}
+
+/* splits() adds to scores every pair of a left child over i..j and a
+ * right child over j..k, for all i < j < k, and returns their log
+ * scale.  The right children's scores are inside or prefix scores.
+ */
+static FLOAT
+splits(prefix_chart pc, const grammar *g, size_t i, size_t k, int prefix,
+       FLOAT *scores, bitword *labels)
+{
+  FLOAT	 scale = LOG_ZERO;
+  size_t j, b;
+
+#define RSCALE(j)	(prefix ? pc->pscale[j] : pc->iscale[INOUT_SPAN(j, k)])
+
+  /* each split's scores are rescaled to the best split's scale */
+  for (j = i+1; j < k; j++)
+    if (pc->iscale[INOUT_SPAN(i, j)] + RSCALE(j) > scale)
+      scale = pc->iscale[INOUT_SPAN(i, j)] + RSCALE(j);
+  for (j = i+1; j < k; j++) {
+    size_t  s = INOUT_SPAN(i, j);
+    FLOAT   split = pc->iscale[s] + RSCALE(j), factor;
+    bitword *post = LABELS(pc, post, s);
+
+    if (split - scale <= -700)	/* exp() underflows */
+      continue;
+    factor = exp(split - scale);
+    for (b = bitset_next_and(post, g->left_nts, 0, g->nnts); b < g->nnts;
+         b = bitset_next_and(post, g->left_nts, b+1, g->nnts))
+      binary(pc, g, b, factor * SCORES(pc, ins_post, s)[b], i, j, k, prefix,
+             scores, labels);
+    if (j == i+1)		/* the word is a left child */
+      binary(pc, g, pc->term[i], factor * exp(-pc->iscale[s]), i, j, k, prefix,
+             scores, labels);
+  }
+#undef RSCALE
+  return scale;
+}
+
+FLOAT
+prefix_word(prefix_chart pc, si_index word)
+{
+  const grammar	*g = pc->pg->ig->g;
+  const FLOAT	*bprob = pc->pg->ig->bprob;
+  const sum_closure lc = pc->pg->lcorners;
+  size_t	k, i, x, b;
+  unsigned	w;
+
+  if (pc->lprob == LOG_ZERO)	/* so is every longer prefix's */
+    return LOG_ZERO;
+  if ((w = grammar_label_id(g, word)) == NO_ID)
+    return pc->lprob = LOG_ZERO;
+  k = ++pc->n;
+  if (k > pc->nsize)
+    grow(pc, k);
+  pc->term[k-1] = w;
+
+  /* inside scores of column k */
+
+  memset(SCORES(pc, ins_pre, INOUT_SPAN(0, k)), 0, k * pc->nnts * sizeof(FLOAT));
+  memset(SCORES(pc, ins_post, INOUT_SPAN(0, k)), 0, k * pc->nnts * sizeof(FLOAT));
+  memset(LABELS(pc, pre, INOUT_SPAN(0, k)), 0, k * pc->words * sizeof(bitword));
+  memset(LABELS(pc, post, INOUT_SPAN(0, k)), 0, k * pc->words * sizeof(bitword));
+  for (i = k; i-- > 0; ) {
+    size_t s = INOUT_SPAN(i, k);
+    FLOAT  scale = 0, *pre = SCORES(pc, ins_pre, s);
+
+    if (i == k-1) {
+      urules urs = g->child_urs[w];
+
+      for (x = 0; x < urs.n; x++) {
+        pre[g->label_id[urs.e[x]->parent]] += exp(urs.e[x]->prob);
+        BITSET_SET(LABELS(pc, pre, s), g->label_id[urs.e[x]->parent]);
+      }}
+    else
+      scale = splits(pc, g, i, k, 0, pre, LABELS(pc, pre, s));
+    pc->iscale[s] = close_layers(pc, g, pre, SCORES(pc, ins_post, s),
+                                 LABELS(pc, post, s), scale);
+  }
+
+  /* prefix scores of i..k */
+
+  memset(pc->pfx_pre, 0, k * pc->nnts * sizeof(FLOAT));
+  memset(pc->pfx_post, 0, k * pc->nnts * sizeof(FLOAT));
+  for (i = k; i-- > 0; ) {
+    FLOAT *pre = SCORES(pc, pfx_pre, i), scale = 0;
+
+    memset(pc->base, 0, pc->nnts * sizeof(FLOAT));
+    if (i == k-1) {		/* rules whose first child is the word */
+      urules	  urs = g->child_urs[w];
+      const bpair *bp;
+
+      for (x = 0; x < urs.n; x++)
+        pc->base[g->label_id[urs.e[x]->parent]] += exp(urs.e[x]->prob);
+      for (bp = g->bpairs + g->bleft_start[w];
+           bp < g->bpairs + g->bleft_start[w+1]; bp++)
+        for (x = bp->start; x < bp[1].start; x++)
+          pc->base[g->label_id[g->bparents[x].parent]] += bprob[x];
+    }
+    else
+      scale = splits(pc, g, i, k, 1, pc->base, NULL);
+    for (b = 0; b < pc->nnts; b++)
+      if (pc->base[b] > 0)
+        for (x = lc->start[b]; x < lc->start[b+1]; x++)
+          pre[lc->sums[x].to] += pc->base[b] * lc->sums[x].sum;
+    pc->pscale[i] = close_layers(pc, g, pre, SCORES(pc, pfx_post, i), NULL, scale);
+  }
+
+  /* the root has id 0 */
+  return pc->lprob = SCORES(pc, pfx_post, 0)[0] > 0 ?
+    log(SCORES(pc, pfx_post, 0)[0]) + pc->pscale[0] : LOG_ZERO;
+}
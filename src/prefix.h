@@ -0,0 +1,47 @@
+/* prefix.h -- prefix probabilities
+ *
+ * The prefix probability of words w_0 .. w_{k-1} is the total
+ * probability of the sentences that begin with them, so the surprisal
+ * of w_{k-1} is the log prefix probability of the words before it less
+ * that of the words up to it.  prefix_word() computes prefix
+ * probabilities a word at a time as in Jelinek and Lafferty (1991),
+ * from the inside scores of the spans of the words so far and the
+ * prefix scores of the spans ending at the last word, i.e. the
+ * probabilities of each label deriving those words followed by
+ * anything.  Every sentence is parsed in O(n^3) time all told.
+ *
+ * Scores are kept as in inout.c, with a pre and a post unary layer and
+ * every unary chain summed.
+ */
+
+#ifndef PREFIX_H
+#define PREFIX_H
+
+#include "lgrammar.h"
+#include "inout.h"
+
+/* The left corner closure of a grammar: the paths from id in lcorners
+ * go to the nonterminals that have id as a left corner (id itself
+ * included), each with the total probability of the ways down to id
+ * through left children and unary chains.
+ */
+
+typedef struct prefix_grammar {
+  inout_grammar	ig;		/* g's rule probabilities */
+  sum_closure	lcorners;
+} *prefix_grammar;
+
+prefix_grammar make_prefix_grammar(const grammar *g);
+void free_prefix_grammar(prefix_grammar pg);
+
+typedef struct prefix_chart *prefix_chart;
+
+prefix_chart make_prefix_chart(prefix_grammar pg);
+void free_prefix_chart(prefix_chart pc);
+
+/* prefix_word() adds word to the end of pc, and returns the log prefix
+ * probability of pc's words (LOG_ZERO if no sentence starts with them).
+ */
+FLOAT prefix_word(prefix_chart pc, si_index word);
+
+#endif
@@ -0,0 +1,311 @@
+/* recognize.c -- bit-parallel recognition prepass
+ *
+ * The chart has a pre and a post set of nonterminals in each span, as
+ * in inout.c: pre holds the parents of binary (or lexical) rules over
+ * the span, and post their unary closure.  The top-down pass marks a
+ * post label live if it is the root over the whole sentence or a child
+ * of a live binary parent, and a pre label live if one of its
+ * ancestors (or itself) is a live post label.
+ *
+ * Besides the sets of labels of each span, the chart keeps, for each
+ * position i and label a, the set of positions k such that a is in
+ * (the pre, post, ... set of) span i..k.  A child pair (b, c) with b
+ * over i..j then adds its parents to every span i..k with c over j..k
+ * at once, by or-ing the ends of c at j into the ends of its parents
+ * at i.  As in cky() in llncky.c, spans are visited by left position
+ * and then by right position.
+ */
+
+#include "recognize.h"
+#include "mmm.h"
+#include "deadline.h"
+#include <string.h>
+
+recognizer
+make_recognizer(const grammar *g)
+{
+  recognizer	r = MALLOC(sizeof(struct recognizer));
+  size_t	nnts = g->nnts, nb = g->bpairs[g->nbpairs].start, id, k, w, x;
+
+  r->g = g;
+  r->words = BITSET_WORDS(nnts);
+  r->rights = CALLOC(nnts * r->words, sizeof(bitword));
+  r->rank = MALLOC(nnts * (r->words + 1) * sizeof(unsigned));
+  for (id = 0; id < nnts; id++) {
+    unsigned *rank = r->rank + id*(r->words + 1);
+
+    for (k = g->bleft_start[id]; k < g->bleft_start[id+1]; k++)
+      if (g->bpairs[k].right < nnts)
+        BITSET_SET(RECOGNIZER_SET(r, rights, id), g->bpairs[k].right);
+    rank[0] = 0;
+    for (w = 0; w < r->words; w++)
+      rank[w+1] = rank[w]
+        + __builtin_popcountl(RECOGNIZER_SET(r, rights, id)[w]);
+  }
+  r->bparent = MALLOC((nb + 1) * sizeof(unsigned));
+  for (x = 0; x < nb; x++)
+    r->bparent[x] = g->label_id[g->bparents[x].parent];
+  r->up = CALLOC(nnts * r->words, sizeof(bitword));
+  for (id = 0; id < nnts; id++) {
+    BITSET_SET(RECOGNIZER_SET(r, up, id), id);
+    for (x = g->uchains_start[id]; x < g->uchains_start[id+1]; x++)
+      BITSET_SET(RECOGNIZER_SET(r, up, id), g->uchains[x].parent);
+  }
+  return r;
+}
+
+void
+free_recognizer(recognizer r)
+{
+  FREE(r->rights);
+  FREE(r->rank);
+  FREE(r->bparent);
+  FREE(r->up);
+  FREE(r);
+}
+
+static inline void
+set_or(bitword *to, const bitword *from, size_t words)
+{
+  size_t w;
+
+  for (w = 0; w < words; w++)
+    to[w] |= from[w];
+}
+
+/* FOR_PAIRS(r, b, rin, rterm, k, body) runs body with k set to each
+ * pair of left child b whose right child is in rin (or is the word
+ * rterm).  The nonterminal right children of b are found a word at a
+ * time, and since b's pairs are sorted by right child id, the pair of
+ * right child c is b's first pair plus c's rank among b's right
+ * children.
+ */
+
+#define FOR_PAIRS(r, b, rin, rterm, k, body)				\
+  do {									\
+    const grammar *g_ = (r)->g;						\
+    size_t	  k_ = g_->bleft_start[b], w_;				\
+									\
+    if ((b) < g_->nnts) {						\
+      const bitword  *rights_ = RECOGNIZER_SET(r, rights, b);		\
+      const unsigned *rank_ = (r)->rank + (b)*((r)->words+1);		\
+									\
+      for (w_ = 0; w_ < (r)->words; w_++) {				\
+        bitword m_ = rights_[w_] & (rin)[w_];				\
+									\
+        for (; m_; m_ &= m_ - 1) {					\
+          (k) = k_ + rank_[w_] + __builtin_popcountl(rights_[w_]	\
+                               & ((1UL << __builtin_ctzl(m_)) - 1));	\
+          body;								\
+        }}								\
+      k_ += rank_[(r)->words];		/* the word right children */	\
+      if ((rterm) != NO_ID)						\
+        for (; k_ < g_->bleft_start[(b)+1]; k_++)			\
+          if (g_->bpairs[k_].right == (rterm)) {			\
+            (k) = k_;							\
+            body;							\
+          }}								\
+    else		/* b is a word */				\
+      for (; k_ < g_->bleft_start[(b)+1]; k_++)			\
+        if (g_->bpairs[k_].right < g_->nnts				\
+            ? BITSET_TEST(rin, g_->bpairs[k_].right)			\
+            : g_->bpairs[k_].right == (rterm)) {			\
+          (k) = k_;							\
+          body;								\
+        }								\
+  } while (0)
+
+/* The recognition chart of a sentence of length n */
+
+typedef struct rchart {
+  size_t	n, nnts, words, ewords;
+  unsigned	*term;		/* compact id of each word, then NO_ID */
+  bitword	*pre, *post;	/* SPAN_SET(c, pre, i, j) etc. */
+  bitword	*rights;	/* labels of the spans starting at each i */
+  bitword	*pre_ends;	/* ENDS(c, pre_ends, i, a) etc. */
+  bitword	*ends;		/* (the ends of the post labels) */
+  bitword	*livepre_ends;
+  bitword	*live_ends;
+} rchart;
+
+#define SPAN_SET(c, sets, i, j)	((c)->sets + COARSE_SPAN(i, j)*(c)->words)
+#define ENDS(c, sets, i, a)	((c)->sets + ((i)*(c)->nnts + (a))*(c)->ewords)
+
+/* binary_up() adds the parents of left child b over i..j and each right
+ * child starting at j (or the word rterm) to the pre ends at i.
+ */
+static inline void
+binary_up(recognizer r, rchart *c, unsigned b, size_t i, size_t j,
+          unsigned rterm)
+{
+  const grammar	*g = r->g;
+  size_t	x, y;
+
+  FOR_PAIRS(r, b, c->rights + j*c->words, rterm, x, {
+      unsigned right = g->bpairs[x].right;
+
+      for (y = g->bpairs[x].start; y < g->bpairs[x+1].start; y++)
+        if (right < g->nnts)
+          set_or(ENDS(c, pre_ends, i, r->bparent[y]), ENDS(c, ends, j, right),
+                 c->ewords);
+        else
+          BITSET_SET(ENDS(c, pre_ends, i, r->bparent[y]), j+1);
+    });
+}
+
+/* binary_down() marks left child b over i..j and the right children
+ * starting at j live wherever they have a live parent.  k_live is
+ * scratch space for the live ends of the parents of a pair.
+ */
+static inline void
+binary_down(recognizer r, rchart *c, unsigned b, size_t i, size_t j,
+            unsigned rterm, bitword *k_live)
+{
+  const grammar	*g = r->g;
+  size_t	x, y, w;
+
+  FOR_PAIRS(r, b, c->rights + j*c->words, rterm, x, {
+      unsigned right = g->bpairs[x].right;
+      bitword  any = 0;
+
+      memset(k_live, 0, c->ewords * sizeof(bitword));
+      for (y = g->bpairs[x].start; y < g->bpairs[x+1].start; y++)
+        set_or(k_live, ENDS(c, livepre_ends, i, r->bparent[y]), c->ewords);
+      if (right < g->nnts) {
+        const bitword *e = ENDS(c, ends, j, right);
+        bitword *le = ENDS(c, live_ends, j, right);
+
+        for (w = 0; w < c->ewords; w++) {
+          bitword k = k_live[w] & e[w];
+
+          le[w] |= k;
+          any |= k;
+        }}
+      else
+        any = BITSET_TEST(k_live, j+1);
+      if (any && b < g->nnts)
+        BITSET_SET(ENDS(c, live_ends, i, b), j);
+    });
+}
+
+coarse_mask
+recognize(recognizer r, const struct vindex *terms)
+{
+  const grammar	*g = r->g;
+  size_t	n = terms->n, nnts = g->nnts, words = r->words;
+  size_t	nspans = n*(n+1)/2, nends, i, j, a, b;
+  coarse_mask	m = MALLOC(sizeof(struct coarse_mask));
+  rchart	c;
+  bitword	*k_live;
+
+  m->n = n;
+  m->parsed = 0;
+  m->words = words;
+  m->allowed = CALLOC(nspans * words, sizeof(bitword));
+  m->spans = CALLOC(n+1, BITSET_BYTES(n+1));
+  if (n == 0)
+    return m;
+
+  c.n = n;
+  c.nnts = nnts;
+  c.words = words;
+  c.ewords = BITSET_WORDS(n+1);
+  c.term = MALLOC((n + 1) * sizeof(unsigned));
+  for (i = 0; i < n; i++)
+    if ((c.term[i] = grammar_label_id(g, terms->e[i])) == NO_ID) {
+      FREE(c.term);		/* unknown word, so no parse */
+      return m;
+    }
+  c.term[n] = NO_ID;
+
+  nends = (n+1) * nnts * c.ewords;
+  c.pre = CALLOC(nspans * words, sizeof(bitword));
+  c.post = CALLOC(nspans * words, sizeof(bitword));
+  c.rights = CALLOC((n+1) * words, sizeof(bitword));
+  c.pre_ends = CALLOC(4 * nends, sizeof(bitword));
+  c.ends = c.pre_ends + nends;
+  c.livepre_ends = c.ends + nends;
+  c.live_ends = c.livepre_ends + nends;
+  k_live = MALLOC(c.ewords * sizeof(bitword));
+
+  /* bottom-up: the labels each span can have */
+
+  for (i = n; i-- > 0; ) {
+    urules	urs = g->child_urs[c.term[i]];
+
+    for (b = 0; b < urs.n; b++)
+      BITSET_SET(ENDS(&c, pre_ends, i, g->label_id[urs.e[b]->parent]), i+1);
+    for (j = i+1; j <= n && !PAST_DEADLINE; j++) {
+      bitword	*spre = SPAN_SET(&c, pre, i, j);
+      bitword	*spost = SPAN_SET(&c, post, i, j);
+
+      for (a = 0; a < nnts; a++)
+        if (BITSET_TEST(ENDS(&c, pre_ends, i, a), j)) {
+          BITSET_SET(spre, a);
+          set_or(spost, RECOGNIZER_SET(r, up, a), words);
+        }
+      for (a = bitset_next(spost, 0, nnts); a < nnts;
+           a = bitset_next(spost, a+1, nnts))
+        BITSET_SET(ENDS(&c, ends, i, a), j);
+      set_or(c.rights + i*words, spost, words);
+      if (j == n)
+        break;
+      for (b = bitset_next_and(spost, g->left_nts, 0, nnts); b < nnts;
+           b = bitset_next_and(spost, g->left_nts, b+1, nnts))
+        binary_up(r, &c, b, i, j, c.term[j]);
+      if (j == i+1)		/* the word is a left child */
+        binary_up(r, &c, c.term[i], i, j, c.term[j]);
+    }
+  }
+
+  /* top-down: the labels that are part of a parse.  The live post
+   * labels of i..j are known once the spans i..k for k > j and the
+   * spans starting before i are done.
+   */
+
+  if (!timed_out && BITSET_TEST(SPAN_SET(&c, post, 0, n), 0)) {
+    m->parsed = 1;
+    BITSET_SET(ENDS(&c, live_ends, 0, 0), n);
+    for (i = 0; i < n && !PAST_DEADLINE; i++) {
+      bitword	*row = COARSE_SPAN_ROW(m, i);
+
+      for (j = n; j > i; j--) {
+        bitword	*spre = SPAN_SET(&c, pre, i, j);
+        bitword	*spost = SPAN_SET(&c, post, i, j);
+        bitword	*allowed = COARSE_ALLOWED(m, i, j);
+
+        if (j < n && bitset_next(row, j+1, n+1) <= n) {
+          for (b = bitset_next_and(spost, g->left_nts, 0, nnts); b < nnts;
+               b = bitset_next_and(spost, g->left_nts, b+1, nnts))
+            binary_down(r, &c, b, i, j, c.term[j], k_live);
+          if (j == i+1)
+            binary_down(r, &c, c.term[i], i, j, c.term[j], k_live);
+        }
+        for (a = bitset_next(spost, 0, nnts); a < nnts;
+             a = bitset_next(spost, a+1, nnts))
+          if (BITSET_TEST(ENDS(&c, live_ends, i, a), j))
+            BITSET_SET(allowed, a);
+        for (b = bitset_next(spre, 0, nnts); b < nnts;
+             b = bitset_next(spre, b+1, nnts))
+          if (bitset_intersects(RECOGNIZER_SET(r, up, b), allowed, nnts)) {
+            BITSET_SET(ENDS(&c, livepre_ends, i, b), j);
+            BITSET_SET(row, j);
+          }
+        for (b = bitset_next(spre, 0, nnts); b < nnts;
+             b = bitset_next(spre, b+1, nnts))
+          if (BITSET_TEST(ENDS(&c, livepre_ends, i, b), j))
+            BITSET_SET(allowed, b);
+      }
+    }
+  }
+
+  if (timed_out)
+    m->parsed = 0;	/* the mask isn't finished */
+  FREE(c.term);
+  FREE(c.pre);
+  FREE(c.post);
+  FREE(c.rights);
+  FREE(c.pre_ends);
+  FREE(k_live);
+  return m;
+}
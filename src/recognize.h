@@ -0,0 +1,41 @@
+/* recognize.h -- bit-parallel recognition prepass
+ *
+ * recognize() runs a Boolean CKY over a sentence in which each span
+ * is a bitset of nonterminals, and each rule is applied to all the
+ * right children starting at a position with a few word-wide ors (see
+ * recognize.c).  A bottom-up pass finds the labels each span can have,
+ * and a top-down pass from the root keeps only the ones that are part
+ * of some complete parse.  The result is a mask of the same
+ * kind as the coarse parse's (see coarse.h), so the Viterbi parse
+ * only builds live cells, and skips sentences with no parse entirely.
+ */
+
+#ifndef RECOGNIZE_H
+#define RECOGNIZE_H
+
+#include "lgrammar.h"
+#include "vindex.h"
+#include "bitset.h"
+#include "coarse.h"
+
+typedef struct recognizer {
+  const grammar	*g;
+  size_t	words;		/* bitwords per set of nonterminals */
+  bitword	*rights;	/* nonterminal right children of each left child */
+  unsigned	*rank;		/* right children before each word of rights */
+  unsigned	*bparent;	/* id of each of g->bparents */
+  bitword	*up;		/* each nonterminal and its unary ancestors */
+} *recognizer;
+
+#define RECOGNIZER_SET(r, sets, i)	((r)->sets + (i)*(r)->words)
+
+recognizer make_recognizer(const grammar *g);
+void free_recognizer(recognizer r);
+
+/* recognize() returns the labels of terms' spans that are part of
+ * some parse, or a mask with parsed 0 if there is no parse or the
+ * deadline passed (see deadline.h).
+ */
+coarse_mask recognize(recognizer r, const struct vindex *terms);
+
+#endif
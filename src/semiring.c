@@ -0,0 +1,42 @@
+/* semiring.c -- CKY over semirings
+ */
+
+#include "semiring.h"
+#include <math.h>
+
+/* -ffast-math assumes there are no infinities, so log zero is finite */
+
+#define LOG_ZERO	(-1e30)
+
+#define MAX(x, y)	((x) > (y) ? (x) : (y))
+#define ADD(x, y)	((x) + (y))
+#define MULTIPLY(x, y)	((x) * (y))
+#define OR(x, y)	((x) | (y))
+#define AND(x, y)	((x) & (y))
+#define LPROB(lprob)	(lprob)
+#define UNIT(lprob)	1
+#define SAME(x)		(x)
+#define UNIT_SUMS(g)	unary_sum_closure(g, 0)
+#define COUNT_SUMS(g)	unary_sum_closure(g, 1)
+
+static inline FLOAT
+log_add(FLOAT x, FLOAT y)
+{
+  return x > y ? x + log1p(exp(y - x)) : y + log1p(exp(x - y));
+}
+
+/* The max semirings take the best unary chain and the sum semirings
+ * sum over them all (or count them, with HUGE_VAL if a cycle makes
+ * their number infinite).
+ */
+
+CKY_CODE(viterbi_cky, FLOAT, LOG_ZERO, 0.0, MAX, ADD, LPROB, 
+	 unary_best_closure, SAME)
+CKY_CODE(inside_cky, FLOAT, LOG_ZERO, 0.0, log_add, ADD, LPROB, 
+	 UNIT_SUMS, log)
+CKY_CODE(prob_cky, double, 0.0, 1.0, ADD, MULTIPLY, exp, 
+	 UNIT_SUMS, SAME)
+CKY_CODE(count_cky, double, 0.0, 1.0, ADD, MULTIPLY, UNIT, 
+	 COUNT_SUMS, SAME)
+CKY_CODE(recognize_cky, unsigned char, 0, 1, OR, AND, UNIT, 
+	 unary_best_closure, UNIT)
@@ -0,0 +1,29 @@
+/* semiring.h -- CKY over semirings
+ *
+ * Parsers generated from cky-templates.h that compute the value of
+ * the root category over a sentence without building trees:
+ *
+ *   viterbi_cky	log prob of the best parse (max, +)
+ *   inside_cky		log prob of the sentence (log-sum-exp, +)
+ *   prob_cky		prob of the sentence (+, *), which underflows
+ *			for long sentences
+ *   count_cky		number of parses (+, *)
+ *   recognize_cky	1 iff there is a parse (or, and)
+ *
+ * viterbi_cky and recognize_cky take the best unary chain between
+ * each pair of labels, as the Viterbi parser does; the others sum (or
+ * count) all the chains, so inside_cky agrees with "-P".
+ */
+
+#ifndef SEMIRING_H
+#define SEMIRING_H
+
+#include "cky-templates.h"
+
+CKY_HEADER(viterbi_cky, FLOAT)
+CKY_HEADER(inside_cky, FLOAT)
+CKY_HEADER(prob_cky, double)
+CKY_HEADER(count_cky, double)
+CKY_HEADER(recognize_cky, unsigned char)
+
+#endif
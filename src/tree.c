@@ -10,8 +10,8 @@
 #include <ctype.h>
 
 #ifndef NDEBUG
-size_t trees_allocated = 0;
-size_t bintrees_allocated = 0;
+__thread size_t trees_allocated = 0;
+__thread size_t bintrees_allocated = 0;
 #endif
 
 tree
@@ -12,8 +12,8 @@
 #include <stdio.h>
 
 #ifndef NDEBUG
-extern size_t trees_allocated;
-extern size_t bintrees_allocated;
+extern __thread size_t trees_allocated;
+extern __thread size_t bintrees_allocated;
 #endif
 
 typedef struct tree {